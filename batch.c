@@ -0,0 +1,443 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "batch.h"
+#include "compression.h"
+#include "dict.h"
+#include "format.h"
+#include "frame.h"
+#include "pool.h"
+#include "progress.h"
+
+/* A batch of files compressed or decompressed one after the other by every
+ * worker of a pool, each taking the next file once done with its last one.
+ * The counters are guarded by lock.
+ */
+typedef struct batch {
+  char **files;
+  int count;
+  const char *output_dir;
+  int compress;
+  int level;
+  const uint8_t *dict;
+  size_t dict_len;
+
+  pthread_mutex_t lock;
+  int next;
+  int failed;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t total;
+} batch_t;
+
+/* A worker of a batch and what it keeps from file to file: its compression
+ * context and its input and output buffers, grown as needed.
+ */
+typedef struct batch_worker {
+  pool_job_t job;
+  batch_t *batch;
+  lz77_cctx_t *ctx;
+  uint8_t *in;
+  size_t in_size;
+  uint8_t *out;
+  size_t out_size;
+} batch_worker_t;
+
+/* Return 1 if name ends with suffix, 0 otherwise
+ */
+static int has_suffix (const char *name, const char *suffix) {
+  size_t len = strlen (name), suffix_len = strlen (suffix);
+  return len >= suffix_len && strcmp (name + len - suffix_len, suffix) == 0;
+}
+
+/* Add a copy of path to the *count files of *files, which has room for
+ * *size of them, growing it as needed. Its size is added to total.
+ * Return 0 for success and -1 for failure.
+ */
+static int add_file (char ***files, int *count, int *size, const char *path,
+    uint64_t len, uint64_t *total) {
+  char **grown;
+
+  if (*count == *size) {
+    *size = *size ? *size * 2 : 64;
+    grown = realloc (*files, *size * sizeof (char*));
+    if (!grown) {
+      return -1;
+    }
+    *files = grown;
+  }
+  (*files)[*count] = strdup (path);
+  if (!(*files)[*count]) {
+    return -1;
+  }
+  *count += 1;
+  *total += len;
+  return 0;
+}
+
+/* Add the regular files of directory dir to files, as add_file does.
+ * Only files with BATCH_SUFFIX are decompressed, and only files without
+ * it compressed.
+ * Return 0 for success and -1 for failure.
+ */
+static int add_dir (char ***files, int *count, int *size, const char *dir,
+    int compress, uint64_t *total) {
+  DIR *d;
+  struct dirent *entry;
+  struct stat st;
+  char *path;
+  int result;
+
+  d = opendir (dir);
+  if (!d) {
+    fprintf (stderr, "Failed to open directory %s\n", dir);
+    perror ("opendir");
+    return -1;
+  }
+  result = 0;
+  while (result == 0 && (entry = readdir (d))) {
+    if (has_suffix (entry->d_name, BATCH_SUFFIX) == compress) continue;
+    path = malloc (strlen (dir) + strlen (entry->d_name) + 2);
+    if (!path) {
+      result = -1;
+      break;
+    }
+    sprintf (path, "%s/%s", dir, entry->d_name);
+    if (stat (path, &st) == 0 && S_ISREG (st.st_mode)) {
+      result = add_file (files, count, size, path, st.st_size, total);
+    }
+    free (path);
+  }
+  closedir (d);
+  return result;
+}
+
+/* Name of the output of file: file with BATCH_SUFFIX added when
+ * compressing, or removed when decompressing, BATCH_OUT_SUFFIX being added
+ * instead if it has none. The output goes to output_dir if not NULL,
+ * next to file otherwise.
+ * Return the name, to be freed, or NULL for failure.
+ */
+static char* output_name (const char *file, const char *output_dir,
+    int compress) {
+  const char *base;
+  char *name;
+  size_t len;
+
+  base = file;
+  if (output_dir) {
+    base = strrchr (file, '/') ? strrchr (file, '/') + 1 : file;
+  }
+  len = strlen (base);
+  if (!compress && has_suffix (base, BATCH_SUFFIX)) {
+    len -= strlen (BATCH_SUFFIX);
+  }
+  name = malloc ((output_dir ? strlen (output_dir) + 1 : 0) + len
+      + strlen (BATCH_OUT_SUFFIX) + strlen (BATCH_SUFFIX) + 1);
+  if (!name) {
+    return NULL;
+  }
+  if (output_dir) {
+    sprintf (name, "%s/%.*s", output_dir, (int) len, base);
+  } else {
+    sprintf (name, "%.*s", (int) len, base);
+  }
+  if (compress) {
+    strcat (name, BATCH_SUFFIX);
+  } else if (!has_suffix (base, BATCH_SUFFIX)) {
+    strcat (name, BATCH_OUT_SUFFIX);
+  }
+  return name;
+}
+
+/* Make *buf, which holds *size bytes, hold at least len bytes.
+ * Return 0 for success and -1 for failure.
+ */
+static int reserve (uint8_t **buf, size_t *size, size_t len) {
+  uint8_t *grown;
+
+  if (len <= *size) {
+    return 0;
+  }
+  grown = realloc (*buf, len);
+  if (!grown) {
+    return -1;
+  }
+  *buf = grown;
+  *size = len;
+  return 0;
+}
+
+/* Read the whole of file into the input buffer of worker,
+ * its size being put in len.
+ * Return 0 for success and -1 for failure.
+ */
+static int read_file (batch_worker_t *worker, const char *file,
+    size_t *len) {
+  FILE *in;
+  struct stat st;
+  int result;
+
+  in = fopen (file, "rb");
+  if (!in) {
+    perror (file);
+    return -1;
+  }
+  result = -1;
+  if (fstat (fileno (in), &st) == 0
+      && reserve (&worker->in, &worker->in_size, st.st_size) == 0) {
+    *len = fread (worker->in, 1, st.st_size, in);
+    result = *len == st.st_size ? 0 : -1;
+  }
+  if (result != 0) {
+    perror (file);
+  }
+  fclose (in);
+  return result;
+}
+
+/* Write the len bytes of the output buffer of worker to file.
+ * Return 0 for success and -1 for failure.
+ */
+static int write_file (batch_worker_t *worker, const char *file, size_t len) {
+  FILE *out;
+  int result;
+
+  out = fopen (file, "wb");
+  if (!out) {
+    perror (file);
+    return -1;
+  }
+  result = fwrite (worker->out, 1, len, out) == len ? 0 : -1;
+  if (fclose (out) != 0) {
+    result = -1;
+  }
+  if (result != 0) {
+    perror (file);
+  }
+  return result;
+}
+
+/* Compress the len bytes read by worker to its output buffer, behind a
+ * format header unless of the legacy preset and a dictionary header when
+ * the batch has a dictionary.
+ * The compressed size is put in out_len.
+ * Return 0 for success and -1 for failure.
+ */
+static int compress_input (batch_worker_t *worker, size_t len,
+    size_t *out_len) {
+  batch_t *batch = worker->batch;
+  size_t format = FORMAT_HEADER_LEN;
+  size_t header = format + (batch->dict_len ? DICT_HEADER_SIZE : 0);
+
+  if (reserve (&worker->out, &worker->out_size,
+        header + compress_bound (len)) != 0) {
+    return -1;
+  }
+  if (format) {
+    format_put_header (worker->out);
+  }
+  if (batch->dict_len) {
+    dict_put_header (worker->out + format,
+        dict_id (batch->dict, batch->dict_len));
+  }
+  if (lz77_cctx_compress (worker->ctx, worker->in, len, worker->out + header,
+        worker->out_size - header, out_len, batch->level, batch->dict,
+        batch->dict_len) != 0) {
+    return -1;
+  }
+  *out_len += header;
+  return 0;
+}
+
+/* Decompress the len bytes read by worker to its output buffer, either a
+ * framed file or a headerless stream, behind a format header or a
+ * dictionary header or not.
+ * The decompressed size is put in out_len.
+ * Return 0 for success and -1 for failure.
+ */
+static int decompress_input (batch_worker_t *worker, size_t len,
+    size_t *out_len) {
+  batch_t *batch = worker->batch;
+  const uint8_t *src = worker->in;
+  uint64_t size;
+  size_t format;
+
+  if (is_framed (src, len)) {
+    if (framed_size (src, len, &size) < 0
+        || reserve (&worker->out, &worker->out_size, size) != 0) {
+      return -1;
+    }
+    *out_len = size;
+    return decompress_framed_buffer (src, len, worker->out, 1);
+  }
+  format = format_skip_header (src, len);
+  if (format == (size_t) -1) {
+    return -1;
+  }
+  src += format;
+  len -= format;
+  if (is_dict_header (src, len)) {
+    if (dict_check (dict_header_id (src), batch->dict, batch->dict_len)
+        != 0) {
+      return -1;
+    }
+    src += DICT_HEADER_SIZE;
+    len -= DICT_HEADER_SIZE;
+  }
+  if (reserve (&worker->out, &worker->out_size, decompress_bound (len))
+      != 0) {
+    return -1;
+  }
+  return decompress_buffer_dict (src, len, worker->out, worker->out_size,
+      out_len, batch->dict, batch->dict_len);
+}
+
+/* Compress or decompress the files of the batch of a worker until none is
+ * left, counting the bytes and failures.
+ */
+static void run_worker (pool_job_t *job) {
+  batch_worker_t *worker = (batch_worker_t*) job;
+  batch_t *batch = worker->batch;
+  const char *file;
+  char *output;
+  size_t len, out_len;
+  int i, result;
+
+  while (1) {
+    pthread_mutex_lock (&batch->lock);
+    i = batch->next++;
+    pthread_mutex_unlock (&batch->lock);
+    if (i >= batch->count) break;
+
+    file = batch->files[i];
+    output = output_name (file, batch->output_dir, batch->compress);
+    len = 0;
+    out_len = 0;
+    result = (output && read_file (worker, file, &len) == 0) ? 0 : -1;
+    if (result == 0) {
+      result = batch->compress ? compress_input (worker, len, &out_len)
+        : decompress_input (worker, len, &out_len);
+      if (result != 0) {
+        fprintf (stderr, "Failed to %s file %s\n",
+            batch->compress ? "compress" : "decompress", file);
+      }
+    }
+    if (result == 0) {
+      result = write_file (worker, output, out_len);
+    }
+    free (output);
+
+    pthread_mutex_lock (&batch->lock);
+    batch->bytes_in += len;
+    batch->bytes_out += result == 0 ? out_len : 0;
+    batch->failed += result != 0;
+    progress_report (batch->bytes_in, batch->total, 0);
+    pthread_mutex_unlock (&batch->lock);
+  }
+}
+
+/* Compress at level or decompress count inputs, files or directories whose
+ * regular files are taken, on threads workers. Every file is read whole
+ * and its output written to output_dir, or next to it if NULL, named as
+ * output_name says. Files are compressed to headerless streams, behind a
+ * dictionary header if dict_len is not 0, and decompressed from those or
+ * from framed files. Every worker keeps its context and buffers from file
+ * to file. The total throughput is reported once done.
+ * Return 0 for success and -1 if any file failed.
+ */
+int run_batch (int compress, char **inputs, int count,
+    const char *output_dir, int threads, int level,
+    const uint8_t *dict, size_t dict_len) {
+  int i, size, result;
+  struct stat st;
+  struct timespec start, end;
+  double elapsed;
+  batch_t batch;
+  batch_worker_t *workers;
+  pool_t *pool;
+
+  memset (&batch, 0, sizeof (batch_t));
+  batch.output_dir = output_dir;
+  batch.compress = compress;
+  batch.level = level;
+  batch.dict = dict;
+  batch.dict_len = dict_len;
+  result = 0;
+  size = 0;
+  for (i = 0; result == 0 && i < count; i++) {
+    if (stat (inputs[i], &st) != 0) {
+      perror (inputs[i]);
+      result = -1;
+    } else if (S_ISDIR (st.st_mode)) {
+      result = add_dir (&batch.files, &batch.count, &size, inputs[i],
+          compress, &batch.total);
+    } else {
+      result = add_file (&batch.files, &batch.count, &size, inputs[i],
+          st.st_size, &batch.total);
+    }
+  }
+
+  workers = calloc (threads, sizeof (batch_worker_t));
+  pool = result == 0 && workers ? pool_new (threads) : NULL;
+  for (i = 0; pool && i < threads; i++) {
+    workers[i].job.run = run_worker;
+    workers[i].batch = &batch;
+    workers[i].ctx = compress ? lz77_cctx_new () : NULL;
+    if (compress && !workers[i].ctx) break;
+  }
+  if (result == 0 && (!pool || i < threads)) {
+    perror ("run_batch");
+    result = -1;
+  }
+
+  if (result == 0) {
+    pthread_mutex_init (&batch.lock, NULL);
+    fprintf (stderr, "%s %d file%s...\n",
+        compress ? "Compressing" : "Decompressing", batch.count,
+        batch.count == 1 ? "" : "s");
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (i = 0; i < threads; i++) {
+      pool_submit (pool, &workers[i].job);
+    }
+    for (i = 0; i < threads; i++) {
+      pool_wait (pool, &workers[i].job);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    progress_report (batch.bytes_in, batch.total, 1);
+    pthread_mutex_destroy (&batch.lock);
+
+    // Throughput in uncompressed bytes either way
+    elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf (stderr, "%d file%s, %lu bytes to %lu bytes in %.3f s, "
+        "%.1f MB/s, %.0f files/s\n", batch.count - batch.failed,
+        batch.count - batch.failed == 1 ? "" : "s",
+        (unsigned long) batch.bytes_in, (unsigned long) batch.bytes_out,
+        elapsed, elapsed > 0
+        ? (compress ? batch.bytes_in : batch.bytes_out) / elapsed / 1e6 : 0,
+        elapsed > 0 ? batch.count / elapsed : 0);
+    if (batch.failed) {
+      fprintf (stderr, "%d file%s failed\n", batch.failed,
+          batch.failed == 1 ? "" : "s");
+      result = -1;
+    }
+  }
+
+  if (pool) pool_destroy (&pool);
+  for (i = 0; workers && i < threads; i++) {
+    if (workers[i].ctx) lz77_cctx_destroy (&workers[i].ctx);
+    free (workers[i].in);
+    free (workers[i].out);
+  }
+  free (workers);
+  for (i = 0; i < batch.count; i++) {
+    free (batch.files[i]);
+  }
+  free (batch.files);
+  return result;
+}
@@ -0,0 +1,13 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Suffix of the files compressed by a batch
+#define BATCH_SUFFIX ".lz77"
+// Suffix of the files decompressed from inputs without BATCH_SUFFIX
+#define BATCH_OUT_SUFFIX ".out"
+
+int run_batch (int compress, char **inputs, int count,
+    const char *output_dir, int threads, int level,
+    const uint8_t *dict, size_t dict_len);
+
+#endif
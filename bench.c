@@ -0,0 +1,535 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "compression.h"
+
+/* Benchmark of compress_buffer and decompress_buffer over deterministic
+ * synthetic corpora. Every corpus, size and level is run in a child process
+ * so its peak RSS is its own.
+ */
+
+#define MAX_LIST 16
+#define DEFAULT_REPS 5
+
+enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+typedef void (*generate_fn) (uint8_t *buf, size_t len, uint64_t *seed);
+
+typedef struct corpus {
+  const char *name;
+  generate_fn generate;
+} corpus_t;
+
+/* Results of one corpus, size and level, times in seconds
+ */
+typedef struct result {
+  size_t compressed_len;
+  double compress_median;
+  double compress_p95;
+  double decompress_median;
+  double decompress_p95;
+  long peak_rss;
+} result_t;
+
+/* xorshift64*, the same sequence for the same seed on every machine
+ */
+static uint64_t next_random (uint64_t *seed) {
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random number below n, small numbers much more likely than large ones
+ */
+static uint32_t skewed_random (uint64_t *seed, uint32_t n) {
+  uint64_t r = next_random (seed);
+  return (uint32_t) ((r & 0xFFFF) % n) * (uint32_t) ((r >> 16 & 0xFFFF) % n)
+    / n;
+}
+
+/* Fill buf with copies of the lines made by line until len bytes are filled
+ */
+static void fill_lines (uint8_t *buf, size_t len, uint64_t *seed,
+    int (*line) (char *dst, size_t size, uint64_t *seed)) {
+  char text[0x200];
+  size_t pos, n;
+
+  for (pos = 0; pos < len; pos += n) {
+    n = line (text, sizeof (text), seed);
+    if (n > len - pos) n = len - pos;
+    memcpy (buf + pos, text, n);
+  }
+}
+
+static void generate_random (uint8_t *buf, size_t len, uint64_t *seed) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    buf[i] = next_random (seed) >> 56;
+  }
+}
+
+static void generate_zeros (uint8_t *buf, size_t len, uint64_t *seed) {
+  memset (buf, 0, len);
+}
+
+static const char *words[] = {
+  "the", "of", "and", "to", "a", "in", "is", "that", "it", "was", "for",
+  "on", "are", "as", "with", "his", "they", "at", "be", "this", "from",
+  "have", "or", "by", "one", "had", "not", "but", "what", "all", "were",
+  "when", "we", "there", "can", "an", "your", "which", "their", "said",
+  "if", "do", "will", "each", "about", "how", "up", "out", "them", "then",
+  "she", "many", "some", "so", "these", "would", "other", "into", "has",
+  "more", "her", "two", "like", "him", "see", "time", "could", "no", "make",
+  "than", "first", "been", "its", "who", "now", "people", "my", "made",
+  "over", "did", "down", "only", "way", "find", "use", "may", "water",
+  "long", "little", "very", "after", "words", "called", "just", "where",
+  "most", "know", "compression", "window", "pattern", "distance", "history",
+  "through", "between", "because", "without", "something", "government",
+};
+
+/* A sentence of words, common ones more often
+ */
+static int text_line (char *dst, size_t size, uint64_t *seed) {
+  int i, n, len;
+  const char *word;
+
+  n = 4 + next_random (seed) % 16;
+  len = 0;
+  for (i = 0; i < n; i++) {
+    word = words[skewed_random (seed, sizeof (words) / sizeof (words[0]))];
+    len += snprintf (dst + len, size - len, "%s%s", i ? " " : "", word);
+    if (i == 0) dst[0] -= 'a' - 'A';
+    if (i + 1 < n && next_random (seed) % 10 == 0) dst[len++] = ',';
+  }
+  len += snprintf (dst + len, size - len, "%s",
+      next_random (seed) % 6 ? ". " : ".\n\n");
+  return len;
+}
+
+static void generate_text (uint8_t *buf, size_t len, uint64_t *seed) {
+  fill_lines (buf, len, seed, text_line);
+}
+
+static const char *log_levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN",
+  "ERROR"};
+static const char *log_components[] = {"http", "db", "cache", "auth",
+  "scheduler", "worker"};
+static const char *log_messages[] = {
+  "request completed", "cache miss", "connection opened",
+  "connection closed", "retrying after timeout", "query executed",
+  "token refreshed", "job queued",
+};
+
+/* A timestamped log line, the time moving forward a few ms per line
+ */
+static int log_line (char *dst, size_t size, uint64_t *seed) {
+  static uint64_t ms = 0;
+  uint64_t r = next_random (seed);
+
+  ms += r % 50;
+  return snprintf (dst, size,
+      "2024-03-%02u %02u:%02u:%02u.%03u %-5s [%s-%u] %s id=%08x user=%u "
+      "status=%u latency=%ums path=/api/v1/items/%u\n",
+      (unsigned) (1 + ms / 86400000 % 28), (unsigned) (ms / 3600000 % 24),
+      (unsigned) (ms / 60000 % 60), (unsigned) (ms / 1000 % 60),
+      (unsigned) (ms % 1000),
+      log_levels[r % 6], log_components[(r >> 8) % 6],
+      (unsigned) (r >> 16) % 8, log_messages[(r >> 20) % 8],
+      (unsigned) (next_random (seed) >> 32),
+      (unsigned) (1000 + skewed_random (seed, 5000)),
+      (r >> 24) % 20 ? 200u : 500u, (unsigned) (r >> 32) % 300,
+      (unsigned) skewed_random (seed, 100000));
+}
+
+static void generate_log (uint8_t *buf, size_t len, uint64_t *seed) {
+  fill_lines (buf, len, seed, log_line);
+}
+
+/* Machine code like bytes: functions made of common x86-64 instruction
+ * encodings with random operands, padded to 16 bytes, and a few tables of
+ * strings and zeros in between.
+ */
+static void generate_binary (uint8_t *buf, size_t len, uint64_t *seed) {
+  static const uint8_t templates[][8] = {
+    // length, then the opcode bytes, operands are appended randomly
+    {3, 0x48, 0x89, 0xE5}, {3, 0x48, 0x8B, 0x45}, {3, 0x48, 0x83, 0xEC},
+    {2, 0x31, 0xC0}, {1, 0xE8}, {2, 0x0F, 0x84}, {3, 0x48, 0x8D, 0x3D},
+    {2, 0x89, 0x45}, {2, 0x8B, 0x55}, {1, 0x50}, {1, 0x53}, {1, 0x5B},
+    {4, 0x0F, 0x1F, 0x44, 0x00}, {2, 0x85, 0xC0}, {1, 0x74}, {1, 0xEB},
+  };
+  static const uint8_t operands[] = {0, 1, 4, 1, 4, 4, 4, 1, 1, 0, 0, 0, 1,
+    0, 1, 1};
+  static const char strings[] = "libc.so.6\0printf\0malloc\0free\0memcpy\0"
+    "__stack_chk_fail\0.text\0.data\0.bss\0GLIBC_2.14\0";
+  uint64_t r;
+  size_t pos, n, i, t;
+
+  pos = 0;
+  while (pos < len) {
+    r = next_random (seed);
+    if (r % 8 == 0) {
+      // Data: strings or zeros
+      n = 16 + (r >> 8) % 256;
+      for (i = 0; i < n && pos < len; i++) {
+        buf[pos++] = (r >> 4) % 2
+          ? 0 : strings[(i + (r >> 16)) % sizeof (strings)];
+      }
+      continue;
+    }
+
+    // A function: instructions, then padding to 16 bytes
+    n = 4 + (r >> 8) % 40;
+    for (i = 0; i < n && pos < len; i++) {
+      t = skewed_random (seed, sizeof (templates) / sizeof (templates[0]));
+      r = next_random (seed);
+      memcpy (buf + pos, templates[t] + 1,
+          templates[t][0] < len - pos ? templates[t][0] : len - pos);
+      pos += templates[t][0];
+      if (operands[t] == 1 && pos < len) {
+        buf[pos++] = (r % 16) * 8;
+      } else if (operands[t] == 4 && pos < len) {
+        memcpy (buf + pos, &r, len - pos < 4 ? len - pos : 4);
+        pos += 4;
+      }
+    }
+    for (; pos < len && pos % 16; pos++) {
+      buf[pos] = i % 2 ? 0xCC : 0x90;
+    }
+  }
+}
+
+/* Records of 64 bytes with a sequential id, a slowly increasing timestamp,
+ * a type, a name from a small set and a few small values.
+ */
+static void generate_records (uint8_t *buf, size_t len, uint64_t *seed) {
+  uint8_t record[64];
+  uint32_t id, value;
+  uint64_t timestamp, r;
+  size_t pos, n;
+
+  timestamp = 1700000000000ULL;
+  for (id = 0, pos = 0; pos < len; id++, pos += n) {
+    r = next_random (seed);
+    timestamp += r % 1000;
+    value = skewed_random (seed, 10000);
+    memset (record, 0, sizeof (record));
+    memcpy (record, &id, 4);
+    memcpy (record + 4, &timestamp, 8);
+    record[12] = r >> 32 & 0x3;
+    strncpy ((char*) record + 16, words[(r >> 40) % 32], 24);
+    memcpy (record + 40, &value, 4);
+    record[44] = (r >> 48) % 2;
+
+    n = len - pos < sizeof (record) ? len - pos : sizeof (record);
+    memcpy (buf + pos, record, n);
+  }
+}
+
+static const corpus_t corpora[] = {
+  {"random", generate_random},
+  {"zeros", generate_zeros},
+  {"text", generate_text},
+  {"log", generate_log},
+  {"binary", generate_binary},
+  {"records", generate_records},
+};
+#define CORPUS_COUNT (sizeof (corpora) / sizeof (corpora[0]))
+
+static double now () {
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compare_double (const void *a, const void *b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Put the median and the 95th percentile, nearest rank, of the n times
+ * in median and p95. times is sorted in place.
+ */
+static void percentiles (double *times, int n, double *median, double *p95) {
+  qsort (times, n, sizeof (double), compare_double);
+  *median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+  *p95 = times[(95 * n + 99) / 100 - 1];
+}
+
+/* Compress and decompress len bytes of corpus at level reps times.
+ * Return 0 for success and -1 for failure.
+ */
+static int run (const corpus_t *corpus, size_t len, int level, int reps,
+    result_t *result) {
+  int i;
+  uint64_t seed;
+  uint8_t *src, *compressed, *decompressed;
+  size_t compressed_size, decompressed_len;
+  double start, *compress_times, *decompress_times;
+  struct rusage usage;
+
+  compressed_size = compress_bound (len);
+  src = malloc (len ? len : 1);
+  compressed = malloc (compressed_size ? compressed_size : 1);
+  decompressed = malloc (len ? len : 1);
+  compress_times = malloc (reps * sizeof (double));
+  decompress_times = malloc (reps * sizeof (double));
+  if (!src || !compressed || !decompressed || !compress_times
+      || !decompress_times) {
+    perror ("malloc");
+    return -1;
+  }
+  seed = 0x9E3779B97F4A7C15ULL;
+  corpus->generate (src, len, &seed);
+
+  for (i = 0; i < reps; i++) {
+    start = now ();
+    if (compress_buffer (src, len, compressed, compressed_size,
+          &result->compressed_len, level) != 0) {
+      fprintf (stderr, "Failed to compress %s\n", corpus->name);
+      return -1;
+    }
+    compress_times[i] = now () - start;
+
+    start = now ();
+    if (decompress_buffer (compressed, result->compressed_len, decompressed,
+          len, &decompressed_len) != 0
+        || decompressed_len != len || memcmp (src, decompressed, len) != 0) {
+      fprintf (stderr, "Failed to decompress %s\n", corpus->name);
+      return -1;
+    }
+    decompress_times[i] = now () - start;
+  }
+
+  percentiles (compress_times, reps, &result->compress_median,
+      &result->compress_p95);
+  percentiles (decompress_times, reps, &result->decompress_median,
+      &result->decompress_p95);
+  getrusage (RUSAGE_SELF, &usage);
+  result->peak_rss = usage.ru_maxrss;
+
+  free (src);
+  free (compressed);
+  free (decompressed);
+  free (compress_times);
+  free (decompress_times);
+  return 0;
+}
+
+static double mb_per_s (size_t len, double seconds) {
+  return seconds > 0 ? len / seconds / 1e6 : 0;
+}
+
+static void print_header (int format) {
+  switch (format) {
+    case FORMAT_TEXT:
+      printf ("%-8s %10s %5s %7s %10s %10s %10s %10s %10s\n", "corpus",
+          "size", "level", "ratio", "c MB/s", "c p95", "d MB/s", "d p95",
+          "peak KB");
+      break;
+    case FORMAT_CSV:
+      printf ("corpus,size,level,reps,compressed,ratio,"
+          "compress_mbs_median,compress_mbs_p95,"
+          "decompress_mbs_median,decompress_mbs_p95,peak_rss_kb\n");
+      break;
+    case FORMAT_JSON:
+      printf ("[\n");
+      break;
+  }
+}
+
+/* Print result, the p95 throughput being that of the p95 time
+ */
+static void print_result (int format, int first, const corpus_t *corpus,
+    size_t len, int level, int reps, const result_t *result) {
+  double ratio = len ? (double) result->compressed_len / len : 0;
+
+  switch (format) {
+    case FORMAT_TEXT:
+      printf ("%-8s %10lu %5d %7.4f %10.1f %10.1f %10.1f %10.1f %10ld\n",
+          corpus->name, len, level, ratio,
+          mb_per_s (len, result->compress_median),
+          mb_per_s (len, result->compress_p95),
+          mb_per_s (len, result->decompress_median),
+          mb_per_s (len, result->decompress_p95), result->peak_rss);
+      break;
+    case FORMAT_CSV:
+      printf ("%s,%lu,%d,%d,%lu,%.4f,%.2f,%.2f,%.2f,%.2f,%ld\n",
+          corpus->name, len, level, reps, result->compressed_len, ratio,
+          mb_per_s (len, result->compress_median),
+          mb_per_s (len, result->compress_p95),
+          mb_per_s (len, result->decompress_median),
+          mb_per_s (len, result->decompress_p95), result->peak_rss);
+      break;
+    case FORMAT_JSON:
+      printf ("%s  {\"corpus\": \"%s\", \"size\": %lu, \"level\": %d, "
+          "\"reps\": %d, \"compressed\": %lu, \"ratio\": %.4f, "
+          "\"compress_mbs_median\": %.2f, \"compress_mbs_p95\": %.2f, "
+          "\"decompress_mbs_median\": %.2f, \"decompress_mbs_p95\": %.2f, "
+          "\"peak_rss_kb\": %ld}", first ? "" : ",\n",
+          corpus->name, len, level, reps, result->compressed_len, ratio,
+          mb_per_s (len, result->compress_median),
+          mb_per_s (len, result->compress_p95),
+          mb_per_s (len, result->decompress_median),
+          mb_per_s (len, result->decompress_p95), result->peak_rss);
+      break;
+  }
+  fflush (stdout);
+}
+
+/* Parse a comma separated list of numbers, sizes may end with k or m.
+ * Return the number of values put in values, -1 for failure.
+ */
+static int parse_list (char *list, long *values) {
+  int n;
+  char *end;
+
+  for (n = 0; n < MAX_LIST && *list; n++) {
+    values[n] = strtol (list, &end, 10);
+    if (end == list || values[n] < 0) return -1;
+    if (*end == 'k' || *end == 'K') {
+      values[n] <<= 10;
+      end++;
+    } else if (*end == 'm' || *end == 'M') {
+      values[n] <<= 20;
+      end++;
+    }
+    if (*end && *end != ',') return -1;
+    list = *end ? end + 1 : end;
+  }
+  return *list ? -1 : n;
+}
+
+void usage (char *name) {
+  fprintf (stderr, "Usage:\n%s [options]\n"
+      "Options:\n"
+      "  -c NAMES  comma separated corpora, default all of random, zeros,\n"
+      "            text, log, binary, records\n"
+      "  -s SIZES  comma separated sizes in bytes, with k or m suffixes,\n"
+      "            default 64k,1m,16m\n"
+      "  -l LEVELS comma separated compression levels from %d to %d,\n"
+      "            %d being -O, default %d\n"
+      "  -r REPS   repetitions of each run, default %d\n"
+      "  -f FORMAT text, csv or json, default text\n",
+      name, COMPRESS_MIN_LEVEL, COMPRESS_MAX_LEVEL, COMPRESS_MAX_LEVEL,
+      COMPRESS_DEFAULT_LEVEL, DEFAULT_REPS);
+}
+
+int main (int argc, char* argv[]) {
+  int c, i, j, k, format, reps, level_count, size_count, first, status;
+  long sizes[MAX_LIST], levels[MAX_LIST];
+  int selected[CORPUS_COUNT];
+  char *name;
+  pid_t pid;
+  result_t result;
+
+  format = FORMAT_TEXT;
+  reps = DEFAULT_REPS;
+  levels[0] = COMPRESS_DEFAULT_LEVEL;
+  level_count = 1;
+  sizes[0] = 64 << 10;
+  sizes[1] = 1 << 20;
+  sizes[2] = 16 << 20;
+  size_count = 3;
+  for (i = 0; i < CORPUS_COUNT; i++) {
+    selected[i] = 1;
+  }
+
+  while ((c = getopt (argc, argv, "c:s:l:r:f:")) != -1) {
+    switch (c) {
+      case 'c':
+        memset (selected, 0, sizeof (selected));
+        for (name = strtok (optarg, ","); name; name = strtok (NULL, ",")) {
+          for (i = 0; i < CORPUS_COUNT && strcmp (name, corpora[i].name);
+              i++);
+          if (i == CORPUS_COUNT) {
+            usage (argv[0]);
+            return 1;
+          }
+          selected[i] = 1;
+        }
+        break;
+      case 's':
+        size_count = parse_list (optarg, sizes);
+        if (size_count < 1) {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      case 'l':
+        level_count = parse_list (optarg, levels);
+        for (i = 0; i < level_count; i++) {
+          if (levels[i] < COMPRESS_MIN_LEVEL
+              || levels[i] > COMPRESS_MAX_LEVEL) {
+            level_count = -1;
+          }
+        }
+        if (level_count < 1) {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      case 'r':
+        reps = atoi (optarg);
+        if (reps < 1) {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      case 'f':
+        if (strcmp (optarg, "text") == 0) {
+          format = FORMAT_TEXT;
+        } else if (strcmp (optarg, "csv") == 0) {
+          format = FORMAT_CSV;
+        } else if (strcmp (optarg, "json") == 0) {
+          format = FORMAT_JSON;
+        } else {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+    }
+  }
+
+  print_header (format);
+  fflush (stdout);
+  first = 1;
+  for (i = 0; i < CORPUS_COUNT; i++) {
+    if (!selected[i]) continue;
+    for (j = 0; j < size_count; j++) {
+      for (k = 0; k < level_count; k++) {
+        // A child per run so the peak RSS is that of the run alone
+        pid = fork ();
+        if (pid < 0) {
+          perror ("fork");
+          return 1;
+        }
+        if (pid == 0) {
+          if (run (corpora + i, sizes[j], levels[k], reps, &result) != 0) {
+            exit (1);
+          }
+          print_result (format, first, corpora + i, sizes[j], levels[k], reps,
+              &result);
+          exit (0);
+        }
+        if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status)
+            || WEXITSTATUS (status) != 0) {
+          return 1;
+        }
+        first = 0;
+      }
+    }
+  }
+  if (format == FORMAT_JSON) {
+    printf ("\n]\n");
+  }
+  return 0;
+}
@@ -1,38 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "bit_stream.h"
+#include "stats.h"
 
 #define WHERE() printf("%d\n", __LINE__)
 
+// Bytes read from or written to a file at a time
+#define BIT_BLOCK_SIZE 0x10000
+
+/* The file does not need to be seekable, its size is only used to report
+ * progress and is 0 when unknown.
+ */
 bit_in_stream_t* bit_in_stream_new (FILE *file) {
   struct stat file_stat;
   bit_in_stream_t* stream;
 
-  if (fstat (fileno (file), &file_stat) != 0) {
-    return NULL;
+  stream = malloc (sizeof (bit_in_stream_t));
+  if (stream) {
+    stream->buffer = malloc (BIT_BLOCK_SIZE);
+    if (!stream->buffer) {
+      free (stream);
+      return NULL;
+    }
+    stream->file = file;
+    stream->file_size = 0;
+    if (fstat (fileno (file), &file_stat) == 0 && S_ISREG (file_stat.st_mode)) {
+      stream->file_size = file_stat.st_size;
+    }
+    stream->read = 0;
+    stream->bits = 0;
+    stream->bit_count = 0;
+    stream->block = stream->buffer;
+    stream->block_pos = 0;
+    stream->block_len = 0;
   }
+  return stream;
+}
+
+/* Create a stream reading the len bytes at src, which must outlive it
+ */
+bit_in_stream_t* bit_in_stream_new_buffer (const uint8_t *src, size_t len) {
+  bit_in_stream_t* stream;
 
   stream = malloc (sizeof (bit_in_stream_t));
   if (stream) {
-    stream->file = file;
-    stream->file_size = file_stat.st_size;
+    stream->file = NULL;
+    stream->buffer = NULL;
+    stream->file_size = len;
     stream->read = 0;
-    stream->bit_pos = 0;
-    stream->last_byte = 0;
-    fseek (file, 0, SEEK_SET);
+    stream->bits = 0;
+    stream->bit_count = 0;
+    stream->block = src;
+    stream->block_pos = 0;
+    stream->block_len = len;
   }
   return stream;
 }
 
+/* Make the len bytes at src the block of a memory stream, which must
+ * outlive their use. The bits already in the accumulator are read first,
+ * the bytes left in the previous block are dropped.
+ */
+void bit_in_stream_feed (bit_in_stream_t *stream, const uint8_t *src,
+    size_t len) {
+  stream->block = src;
+  stream->block_pos = 0;
+  stream->block_len = len;
+  stream->file_size += len;
+}
+
 void bit_in_stream_destroy (bit_in_stream_t **stream_ptr) {
   bit_in_stream_t *stream = *stream_ptr;
-  fclose (stream->file);
+  if (stream->file) {
+    fclose (stream->file);
+  }
+  free (stream->buffer);
   free (stream);
   *stream_ptr = NULL;
 }
 
+/* Refill the accumulator one byte at a time, reading the next block from
+ * the file whenever the current one runs out.
+ * Return the number of bits in the accumulator.
+ */
+int bit_in_refill_slow (bit_in_stream_t *stream) {
+  STATS_TIMER (start);
+
+  while (stream->bit_count <= 56) {
+    if (stream->block_pos == stream->block_len) {
+      if (!stream->file) break;
+      STATS_START (start);
+      stream->block_len = fread (stream->buffer, 1, BIT_BLOCK_SIZE,
+          stream->file);
+      STATS_STOP (read_time, start);
+      STATS_ADD (bytes_in, stream->block_len);
+      stream->block_pos = 0;
+      if (stream->block_len == 0) break;
+    }
+    stream->bits |= (uint64_t) stream->block[stream->block_pos++]
+      << (56 - stream->bit_count);
+    stream->bit_count += 8;
+    stream->read += 1;
+  }
+  return stream->bit_count;
+}
+
 /*
  * Read 1,4,8 or 12 bits from stream starting at the next bit position
  * in the bit stream, value is put in result
@@ -40,229 +115,188 @@ void bit_in_stream_destroy (bit_in_stream_t **stream_ptr) {
  * Value of result is not modified if operation failed.
  */
 int read_1bit (bit_in_stream_t *stream, uint8_t *result) {
-  uint8_t value;
-  int c;
+  if (bit_in_refill (stream) < 1) return -1;
+  *result = bit_in_peek (stream, 1);
+  bit_in_consume (stream, 1);
+  return 0;
+}
 
-  if (stream->bit_pos) {
-    // last_byte has at least 1 unused bit; do not need to read from stream
-    value = (stream->last_byte >> (7 - stream->bit_pos));
+int read_4bits (bit_in_stream_t *stream, uint8_t *result) {
+  if (bit_in_refill (stream) < 4) return -1;
+  *result = bit_in_peek (stream, 4);
+  bit_in_consume (stream, 4);
+  return 0;
+}
 
-  } else {
-    // Cannot use last_byte; need to read 1 byte from stream
-    if (stream->read >= stream->file_size) {
-      return -1;
-    }
-    c = fgetc (stream->file);
-    value = (c >> 7);
-    stream->last_byte = c;
-    stream->read += 1;
-  }
+int read_8bits (bit_in_stream_t *stream, uint8_t *result) {
+  if (bit_in_refill (stream) < 8) return -1;
+  *result = bit_in_peek (stream, 8);
+  bit_in_consume (stream, 8);
+  return 0;
+}
 
-  stream->bit_pos = (stream->bit_pos + 1) % 8;
-  *result = (value & 0x1);
+int read_12bits (bit_in_stream_t *stream, uint16_t *result) {
+  if (bit_in_refill (stream) < 12) return -1;
+  *result = bit_in_peek (stream, 12);
+  bit_in_consume (stream, 12);
   return 0;
 }
 
-int read_4bits (bit_in_stream_t *stream, uint8_t *result) {
-  uint8_t value;
-  int c;
+/* Read count bits, from 1 to 32, as the functions above
+ */
+int read_bits (bit_in_stream_t *stream, int count, uint32_t *result) {
+  if (bit_in_refill (stream) < count) return -1;
+  *result = bit_in_peek (stream, count);
+  bit_in_consume (stream, count);
+  return 0;
+}
 
-  if (stream->bit_pos == 0) {
-    // Cannot use last_byte; need read 1 byte from stream
-    if (stream->file_size < stream->read + 1) {
-      return -1;
-    }
-    c = fgetc (stream->file);
-    value = (c >> 4);
-    stream->last_byte = c;
-    stream->read += 1;
-    stream->bit_pos = 4;
 
-  } else if (stream->bit_pos > 4) {
-    // last_byte has less than 4 unused bits; need to read 1 byte from stream
-    if (stream->file_size < stream->read + 1) {
-      return -1;
-    }
-    value = (stream->last_byte << (stream->bit_pos - 4));
-    c = fgetc (stream->file);
-    value |= (c >> (12 - stream->bit_pos));
-    stream->last_byte = c;
-    stream->read += 1;
-    stream->bit_pos = stream->bit_pos - 4;
+/* Create a stream writing to file through a block of block_size bytes,
+ * 0 picks a default size. Errors are only checked when a block is written.
+ */
+bit_out_stream_t* bit_out_stream_new (FILE* file, size_t block_size) {
+  bit_out_stream_t* stream;
 
-  } else {
-    // last_byte has at least 4 unused bits; do not need to read from stream
-    value = (stream->last_byte >> (4 - stream->bit_pos));
-    stream->bit_pos = (stream->bit_pos + 4) % 8;
+  if (!block_size) {
+    block_size = BIT_BLOCK_SIZE;
+  }
+  stream = malloc (sizeof (bit_out_stream_t));
+  if (stream) {
+    stream->buffer = malloc (block_size);
+    if (!stream->buffer) {
+      free (stream);
+      return NULL;
+    }
+    stream->file = file;
+    stream->bits = 0;
+    stream->bit_count = 0;
+    stream->block = stream->buffer;
+    stream->block_size = block_size;
+    stream->block_len = 0;
   }
+  return stream;
 
-  *result = (value & 0xF);
-  return 0;
 }
 
-int read_8bits (bit_in_stream_t *stream, uint8_t *result) {
-  uint8_t value;
-  int c;
+/* Create a stream writing to the size bytes at dst, which must outlive it.
+ * Writes fail once dst is full. Bytes of dst past the ones written may be
+ * overwritten too.
+ */
+bit_out_stream_t* bit_out_stream_new_buffer (uint8_t *dst, size_t size) {
+  bit_out_stream_t* stream;
 
-  if (stream->file_size < stream->read + 1) {
-    return -1;
+  stream = malloc (sizeof (bit_out_stream_t));
+  if (stream) {
+    stream->file = NULL;
+    stream->buffer = NULL;
+    stream->bits = 0;
+    stream->bit_count = 0;
+    stream->block = dst;
+    stream->block_size = size;
+    stream->block_len = 0;
   }
+  return stream;
+}
 
-  c = fgetc (stream->file);
-  stream->read += 1;
+/* Write the block of stream to its file and empty it.
+ * Return 0 for success and -1 for failure.
+ */
+static int write_block (bit_out_stream_t *stream) {
+  size_t written;
+  STATS_TIMER (start);
 
-  if (stream->bit_pos) {
-    value = (stream->last_byte << stream->bit_pos);
-    value |= (c >> (8 - stream->bit_pos));
-    stream->last_byte = c;
-  } else {
-    value = c;
+  if (!stream->file) {
+    // A memory buffer cannot be emptied
+    return -1;
   }
-
-  *result = (value & 0xFF);
+  STATS_START (start);
+  written = fwrite (stream->block, 1, stream->block_len, stream->file);
+  STATS_STOP (write_time, start);
+  STATS_ADD (bytes_out, written);
+  if (written != stream->block_len) {
+    return -1;
+  }
+  stream->block_len = 0;
   return 0;
 }
 
-int read_12bits (bit_in_stream_t *stream, uint16_t *result) {
-  uint16_t value;
-  int c;
+/* Move the whole bytes of the accumulator to the block,
+ * writing the block to the file when it is full.
+ * Return 0 for success and -1 for failure.
+ */
+int bit_out_drain (bit_out_stream_t *stream) {
+  uint64_t word;
+  int bytes;
+
+  if (stream->block_size - stream->block_len >= 8) {
+    // Store the whole accumulator, only its full bytes are kept
+    word = stream->bits;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64 (word);
+#endif
+    memcpy (stream->block + stream->block_len, &word, 8);
+    bytes = stream->bit_count >> 3;
+    stream->block_len += bytes;
+    stream->bits = bytes == 8 ? 0 : stream->bits << (8 * bytes);
+    stream->bit_count -= 8 * bytes;
+    return 0;
+  }
 
-  if (stream->bit_pos == 0) {
-    // Cannot use last_byte; need to read 2 bytes from stream
-    if (stream->file_size < stream->read + 2) {
-      return -1;
-    }
-    c = fgetc (stream->file);
-    value = (c << 4);
-    c = fgetc (stream->file);
-    value |= (c >> 4);
-    stream->last_byte = c;
-    stream->bit_pos = 4;
-    stream->read += 2;
-
-  } else if (stream->bit_pos > 4) {
-    // last_byte has less than 4 unused bits; need to read 2 bytes from stream
-    if (stream->file_size < stream->read + 2) {
-      return -1;
-    }
-    value = (stream->last_byte << (stream->bit_pos + 4));
-    c = fgetc (stream->file);
-    value |= (c << (stream->bit_pos - 4));
-    c = fgetc (stream->file);
-    value |= (c >> (12 - stream->bit_pos));
-    stream->last_byte = c;
-    stream->bit_pos -= 4;
-    stream->read += 2;
-
-  } else {
-    // last_byte has at least 4 unused bits; need to read 1 byte from stream
-    if (stream->file_size < stream->read + 1) {
+  while (stream->bit_count >= 8) {
+    if (stream->block_len == stream->block_size
+        && write_block (stream) != 0) {
       return -1;
     }
-    value = (stream->last_byte << (stream->bit_pos + 4));
-    c = fgetc (stream->file);
-    value |= (c >> (4 - stream->bit_pos));
-    stream->last_byte = c;
-    stream->bit_pos = (stream->bit_pos + 4) % 8;
-    stream->read += 1;
+    stream->block[stream->block_len++] = stream->bits >> 56;
+    stream->bits <<= 8;
+    stream->bit_count -= 8;
   }
-
-  *result = (value & 0x0000FFF);
   return 0;
 }
 
-
-bit_out_stream_t* bit_out_stream_new (FILE* file) {
-  bit_out_stream_t* stream;
-
-  stream = malloc (sizeof (bit_out_stream_t));
-  if (stream) {
-    stream->file = file;
-    stream->bit_pos = 0;
-    stream->buffer_byte = 0;
-    fseek (file, 0, SEEK_SET);
+/* Write the buffered bits, padded with 0s to a whole byte,
+ * and the block to the file.
+ * Return 0 for success and -1 for failure.
+ */
+int bit_out_stream_flush (bit_out_stream_t *stream) {
+  if (stream->bit_count & 0x7) {
+    stream->bit_count += 8 - (stream->bit_count & 0x7);
   }
-  return stream;
-
+  if (bit_out_drain (stream) != 0) return -1;
+  if (stream->file) {
+    if (write_block (stream) != 0 || fflush (stream->file) != 0) return -1;
+  }
+  return 0;
 }
 
 void bit_out_stream_destroy (bit_out_stream_t **stream_ptr) {
   bit_out_stream_t *stream = *stream_ptr;
-  if (stream->bit_pos) {
-    fputc (stream->buffer_byte, stream->file);
+  bit_out_stream_flush (stream);
+  if (stream->file) {
+    fclose (stream->file);
   }
-  fclose (stream->file);
+  free (stream->buffer);
   free (stream);
   *stream_ptr = NULL;
 }
 
+/*
+ * Write 1,4,8 or 12 bits of value to stream
+ * Return 0 for success and -1 for failure.
+ */
 int write_1bit (bit_out_stream_t *stream, uint8_t value) {
-  value &= 0x1;
-  stream->buffer_byte |= value << (7 - stream->bit_pos);
-  stream->bit_pos += 1;
-  if (stream->bit_pos == 8) {
-    fputc (stream->buffer_byte, stream->file);
-    if (ferror (stream->file)) return -1;
-    stream->bit_pos = 0;
-    stream->buffer_byte = 0;
-  }
-  return 0;
+  return write_token (stream, value & 0x1, 1);
 }
 
 int write_4bits (bit_out_stream_t *stream, uint8_t value) {
-  value &= 0xF;
-  if (stream->bit_pos > 4) {
-    stream->buffer_byte |= value >> (stream->bit_pos - 4);
-    fputc (stream->buffer_byte, stream->file);
-    if (ferror (stream->file)) return -1;
-    stream->buffer_byte = value << (12 - stream->bit_pos);
-    stream->bit_pos -= 4;
-  } else {
-    stream->buffer_byte |= value << (4 - stream->bit_pos);
-    stream->bit_pos += 4;
-    if (stream->bit_pos == 8) {
-      fputc (stream->buffer_byte, stream->file);
-      if (ferror (stream->file)) return -1;
-      stream->bit_pos = 0;
-      stream->buffer_byte = 0;
-    }
-  }
-  return 0;
+  return write_token (stream, value & 0xF, 4);
 }
 
 int write_8bits (bit_out_stream_t *stream, uint8_t value) {
-  if (stream->bit_pos == 0) {
-    fputc (value, stream->file);
-    if (ferror (stream->file)) return -1;
-  } else {
-    stream->buffer_byte |= (value >> stream->bit_pos);
-    fputc (stream->buffer_byte, stream->file);
-    if (ferror (stream->file)) return -1;
-    stream->buffer_byte = value << (8 - stream->bit_pos);
-  }
-  return 0;
+  return write_token (stream, value, 8);
 }
 
 int write_12bits (bit_out_stream_t *stream, uint16_t value) {
-  uint8_t c;
-  value &= 0xFFF;
-
-  if (stream->bit_pos > 4) {
-    stream->buffer_byte |= value >> (4 + stream->bit_pos);
-    fputc (stream->buffer_byte, stream->file);
-    if (ferror (stream->file)) return -1;
-    c = value >> (stream->bit_pos - 4);
-    fputc (c, stream->file);
-    if (ferror (stream->file)) return -1;
-    stream->buffer_byte = value << (12 - stream->bit_pos);
-    stream->bit_pos -= 4;
-  } else {
-    stream->buffer_byte |= value >> (4 + stream->bit_pos);
-    fputc (stream->buffer_byte, stream->file);
-    if (ferror (stream->file)) return -1;
-    c = value << (4 - stream->bit_pos);
-    stream->buffer_byte = c;
-    stream->bit_pos += 4;
-  }
-  return 0;
+  return write_token (stream, value & 0xFFF, 12);
 }
@@ -2,57 +2,134 @@
 #define BIT_STREAM_H
 
 /* A structure to help read from a file at bits level
- * The structure takes ownership of the opened file when created
+ * The structure takes ownership of the opened file when created.
+ * It can read from a memory buffer instead, in which case file is NULL.
  */
 typedef struct bit_in_stream {
   FILE *file;
 
-  /* The position of the next bit to read in a byte:
-   * If it's a 0 then the next bit is the the MSB of the next byte in stream.
-   * Otherwise it's the bit_pos-th MSB of last_byte.
+  /* The next bit_count bits of the stream, starting at the MSB of bits.
+   * Bits past bit_count are always 0.
    */
-  uint8_t bit_pos;
-  uint8_t last_byte;
+  uint64_t bits;
+  int bit_count;
 
-  /* Size of file in bytes and number of bytes read.
+  /* Bytes not moved to bits yet are block[block_pos] to block[block_len - 1].
+   * block is either buffer, filled from file, or the memory buffer read.
+   */
+  const uint8_t *block;
+  size_t block_pos;
+  size_t block_len;
+  uint8_t *buffer;
+
+  /* Size of file in bytes, 0 if unknown, and number of bytes read.
    */
   uint64_t file_size;
   uint64_t read;
 } bit_in_stream_t;
 
 bit_in_stream_t* bit_in_stream_new (FILE *file);
+bit_in_stream_t* bit_in_stream_new_buffer (const uint8_t *src, size_t len);
+void bit_in_stream_feed (bit_in_stream_t *stream, const uint8_t *src,
+    size_t len);
 void bit_in_stream_destroy (bit_in_stream_t **stream_ptr);
+int bit_in_refill_slow (bit_in_stream_t *stream);
 int read_1bit (bit_in_stream_t *stream, uint8_t *result);
 int read_4bits (bit_in_stream_t *stream, uint8_t *result);
 int read_8bits (bit_in_stream_t *stream, uint8_t *result);
 int read_12bits (bit_in_stream_t *stream, uint16_t *result);
+int read_bits (bit_in_stream_t *stream, int count, uint32_t *result);
+
+/* Make at least 57 bits available in the accumulator of stream,
+ * fewer only at the end of the stream.
+ * Return the number of bits available.
+ */
+static inline int bit_in_refill (bit_in_stream_t *stream) {
+  uint64_t word;
+  int bytes;
+
+  if (stream->bit_count > 56) {
+    return stream->bit_count;
+  }
+  if (stream->block_len - stream->block_pos < 8) {
+    return bit_in_refill_slow (stream);
+  }
+
+  // Load 8 bytes at once and keep the whole bytes that fit
+  memcpy (&word, stream->block + stream->block_pos, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word = __builtin_bswap64 (word);
+#endif
+  bytes = (64 - stream->bit_count) >> 3;
+  stream->bits |= (word >> (64 - 8 * bytes)) << (64 - 8 * bytes - stream->bit_count);
+  stream->bit_count += 8 * bytes;
+  stream->block_pos += bytes;
+  stream->read += bytes;
+  return stream->bit_count;
+}
+
+/* Return the next count bits of stream without consuming them, from 1 up to
+ * the number of bits available. Missing bits at the end of stream read as 0.
+ */
+static inline uint32_t bit_in_peek (bit_in_stream_t *stream, int count) {
+  return stream->bits >> (64 - count);
+}
+
+/* Consume count bits of stream, at most the number of bits available
+ */
+static inline void bit_in_consume (bit_in_stream_t *stream, int count) {
+  stream->bits <<= count;
+  stream->bit_count -= count;
+}
 
 
 
 /* A structure to help write to a file at bits level
- * The structure takes ownership of the opened file when created
+ * The structure takes ownership of the opened file when created.
+ * It can write to a memory buffer instead, in which case file is NULL.
  */
 typedef struct bit_out_stream {
   FILE *file;
 
-  /* The position of the next bit to write in buffer_byte:
-   * If it's a 0 then buffer_byte does not contain any buffered bit.
-   * Otherwise the next value written will overwrite buffer_byte
-   * starting at the bit_pos-th MSG of buffer_byte.
+  /* The bit_count bits written but not moved to block yet,
+   * starting at the MSB of bits. Bits past bit_count are always 0.
    */
-  uint8_t bit_pos;
-  /* Store bits to be written.
-   * It is written to file when all 8 bits are filled
+  uint64_t bits;
+  int bit_count;
+
+  /* Whole bytes written are moved to block, which holds block_size bytes.
+   * block is either buffer, written to file when full,
+   * or the memory buffer written to.
    */
-  uint8_t buffer_byte;
+  uint8_t *block;
+  size_t block_size;
+  size_t block_len;
+  uint8_t *buffer;
 
 } bit_out_stream_t;
 
-bit_out_stream_t* bit_out_stream_new (FILE* file);
+bit_out_stream_t* bit_out_stream_new (FILE* file, size_t block_size);
+bit_out_stream_t* bit_out_stream_new_buffer (uint8_t *dst, size_t size);
+int bit_out_stream_flush (bit_out_stream_t *stream);
 void bit_out_stream_destroy (bit_out_stream_t **stream_ptr);
+int bit_out_drain (bit_out_stream_t *stream);
 int write_1bit (bit_out_stream_t *stream, uint8_t value);
 int write_4bits (bit_out_stream_t *stream, uint8_t value);
 int write_8bits (bit_out_stream_t *stream, uint8_t value);
 int write_12bits (bit_out_stream_t *stream, uint16_t value);
 
+/* Write the count low bits of token to stream, count is at most 32,
+ * e.g. a whole command: its flag bit followed by its payload.
+ * Return 0 for success and -1 for failure.
+ */
+static inline int write_token (bit_out_stream_t *stream, uint32_t token,
+    int count) {
+  if (stream->bit_count + count > 64 && bit_out_drain (stream) != 0) {
+    return -1;
+  }
+  stream->bits |= (uint64_t) token << (64 - stream->bit_count - count);
+  stream->bit_count += count;
+  return 0;
+}
+
 #endif
@@ -7,179 +7,1185 @@
 #include <unistd.h>
 #include "bit_stream.h"
 #include "compression.h"
-#include "hash.h"
-#include "queue.h"
+#include "match.h"
+#include "progress.h"
+#include "stats.h"
 
-int value_leq (uint64_t value, uint64_t arg) {
-  return value <= value;
+// Bits of a <0,VALUE> and of a <1,POINTER,LENGTH>
+#define LITERAL_BITS 9
+#define POINTER_BITS (1 + WINDOW_BITS + LENGTH_BITS)
+#if POINTER_BITS > MIN_MATCH * LITERAL_BITS
+#error "A pointer must not take more bits than the literals it replaces"
+#endif
+// Bytes buffered from the input file, a multiple of PTR_SIZE
+#define IN_BUF_SIZE (PTR_SIZE > 0x10000 ? PTR_SIZE * 8 : PTR_SIZE * 64)
+// Bytes of a memory buffer compressed before positions are rebased
+#define BUFFER_SPAN 0x40000000
+// Bytes decompressed before writing to the output file
+#define OUT_BUF_SIZE IN_BUF_SIZE
+// Bytes written by a pointer copy at most, MAX_MATCH rounded up to 16
+#define WIDE_COPY ((MAX_MATCH + 15) & ~15)
+// Links followed per search by the slowest levels
+#define MAX_CHAIN 0x1000
+// Bytes parsed at a time by the optimal parse
+#define OPTIMAL_CHUNK 0x10000
+
+/* Search parameters of a compression level
+ */
+typedef struct level {
+  // Hash chain links followed per search, 1 only probes the latest position
+  int max_chain;
+  // Stop searching once a pattern of this many bytes is found
+  int good_len;
+  // Look for a longer pattern at the next byte when one is shorter than this
+  int lazy_len;
+  // 0 for none, or after 1 << skip literals in a row, search one byte in
+  // 2, then 1 in 3 after twice as many... without linking the bytes skipped
+  int skip;
+  // Search every byte and pick the commands taking the fewest bits
+  int optimal;
+} level_t;
+
+/* Scratch space of the optimal parse of a chunk: the longest pattern
+ * starting at each byte, then the length of the command picked there,
+ * 1 for a <0,VALUE>, and the cost from there to the end of the chunk,
+ * also kept for the bytes the last pattern can cross it by.
+ */
+typedef struct optimal {
+  uint16_t length[OPTIMAL_CHUNK];
+  uint32_t distance[OPTIMAL_CHUNK];
+  uint32_t cost[OPTIMAL_CHUNK + MAX_MATCH];
+} optimal_t;
+
+static const level_t levels[COMPRESS_MAX_LEVEL + 1] = {
+  {0, 0, 0, 0, 0},
+  // Greedy
+  {1, MAX_MATCH, 0, 4, 0},
+  {2, MAX_MATCH, 0, 5, 0},
+  {4, MAX_MATCH, 0, 0, 0},
+  // Lazy
+  {8, 8, 8, 0, 0},
+  {16, 12, 12, 0, 0},
+  {64, MAX_MATCH, MAX_MATCH + 1, 0, 0},
+  {256, MAX_MATCH, MAX_MATCH + 1, 0, 0},
+  {1024, MAX_MATCH, MAX_MATCH + 1, 0, 0},
+  {MAX_CHAIN, MAX_MATCH, MAX_MATCH + 1, 0, 0},
+  // Optimal
+  {MAX_CHAIN, MAX_MATCH, 0, 0, 1},
+};
+
+/* Return the search parameters of level, clamped to the levels known
+ */
+static const level_t* get_level (int level) {
+  if (level < COMPRESS_MIN_LEVEL) return levels + COMPRESS_MIN_LEVEL;
+  if (level > COMPRESS_MAX_LEVEL) return levels + COMPRESS_MAX_LEVEL;
+  return levels + level;
+}
+
+static match_finder_t* level_finder_new (const level_t *level) {
+  return match_finder_new (PTR_SIZE, level->max_chain, level->good_len);
+}
+
+/* Write a <0,VALUE> command for byte to out.
+ * Return 0 for success and -1 for failure.
+ */
+static inline int write_literal (bit_out_stream_t *out, uint8_t byte) {
+  STATS_ADD (literals, 1);
+  return write_token (out, byte, LITERAL_BITS);
+}
+
+/* Write a <1,POINTER,LENGTH> command for the length bytes distance bytes
+ * back to out. Return 0 for success and -1 for failure.
+ */
+static inline int write_pointer (bit_out_stream_t *out, uint32_t distance,
+    int length) {
+  STATS_ADD (pointers, 1);
+  STATS_ADD (length_hist[length], 1);
+  STATS_HIST (distance_hist, distance >> 1);
+  return write_token (out, 1 << (POINTER_BITS - 1)
+      | (distance - 1) << LENGTH_BITS | (length - LENGTH_BIAS), POINTER_BITS);
 }
 
-void insert_queue_head_prefixes (
-    hash_t *hash, uint8_t *key, int key_len, uint64_t value
-    ) {
-  int i;
-  for (i = 2; i <= key_len; i++) {
-    hash_insert (hash, key, i, value);
+/* Find the longest pattern at buf[pos] as match_finder_find does,
+ * 0 if shorter than MIN_MATCH
+ */
+static inline int find_pattern (match_finder_t *finder, const uint8_t *buf,
+    uint32_t pos, int max_len, uint32_t avail, uint32_t *distance) {
+  int len = match_finder_find (finder, buf, pos, max_len, avail, distance);
+  return len < MIN_MATCH ? 0 : len;
+}
+
+/* Link the patterns starting from *inserted up to pos into the chains,
+ * as far as they can be read before limit.
+ */
+static inline void insert_to (match_finder_t *finder, const uint8_t *buf,
+    uint32_t *inserted, uint32_t pos, uint32_t limit) {
+  for (; *inserted < pos; (*inserted)++) {
+    if (*inserted + 1 < limit) {
+      match_finder_insert (finder, buf, *inserted);
+    }
   }
 }
 
-void delete_queue_head_prefixes (
-    hash_t *hash, uint8_t *key, int key_len, uint64_t value
-    ) {
-  int i;
-  for (i = key_len; i >= 2; i--) {
-    hash_delete (hash, key, i, value_leq, value);
+/* Copy the last PTR_SIZE bytes at most of the dict_len bytes of dict to buf
+ * so that they end right before buf[PTR_SIZE], where the input starts, and
+ * link them into the chains. The pattern at the last byte of dict is left
+ * out as the byte following it is not known yet.
+ */
+static void prime_window (match_finder_t *finder, uint8_t *buf,
+    const uint8_t *dict, size_t dict_len) {
+  uint32_t i;
+
+  if (dict_len > PTR_SIZE) {
+    dict += dict_len - PTR_SIZE;
+    dict_len = PTR_SIZE;
+  }
+  memcpy (buf + PTR_SIZE - dict_len, dict, dict_len);
+  for (i = PTR_SIZE - dict_len; i + 1 < PTR_SIZE; i++) {
+    match_finder_insert (finder, buf, i);
+  }
+}
+
+/* Copy the last PTR_SIZE bytes at most of the dict_len bytes of dict to the
+ * start of buf, the history output is pointed into as for compression.
+ * Return the number of bytes copied.
+ */
+static size_t prime_history (uint8_t *buf, const uint8_t *dict,
+    size_t dict_len) {
+  if (dict_len > PTR_SIZE) {
+    dict += dict_len - PTR_SIZE;
+    dict_len = PTR_SIZE;
+  }
+  memcpy (buf, dict, dict_len);
+  return dict_len;
+}
+
+/* Compress the bytes of buf from *pos up to end, reading patterns up to
+ * limit and pointing up to PTR_SIZE bytes before *pos, searching as level
+ * says. Every byte before *pos must already be linked into the chains.
+ * On return *pos is the first byte not compressed yet,
+ * which may be past end when the last pattern crosses it.
+ * Return 0 for success and -1 for failure.
+ */
+static int compress_span (match_finder_t *finder, const level_t *level,
+    const uint8_t *buf, uint32_t *pos, uint32_t end, uint32_t limit,
+    bit_out_stream_t *out) {
+  int matched, next, misses, step;
+  uint32_t p, inserted, distance, next_distance;
+
+  matched = -1;
+  misses = 0;
+  for (p = *pos, inserted = p; p < end; *pos = p) {
+    if (matched < 0) {
+      matched = find_pattern (finder, buf, p, MAX_MATCH, limit - p, &distance);
+    }
+
+    // A pattern longer by a byte or more at the next byte is worth a literal,
+    // the next byte is searched again by the next span if it is end
+    if (matched && matched < level->lazy_len && p + 1 <= end) {
+      insert_to (finder, buf, &inserted, p + 1, limit);
+      next = find_pattern (finder, buf, p + 1, MAX_MATCH,
+          limit - p - 1, &next_distance);
+      if (next > matched) {
+        if (write_literal (out, buf[p]) != 0) return -1;
+        p++;
+        matched = next;
+        distance = next_distance;
+        continue;
+      }
+    }
+
+    // Write compressed data
+    if (matched) {
+      // <1,POINTER,LENGTH>
+      if (write_pointer (out, distance, matched) != 0) return -1;
+      step = matched;
+      misses = 0;
+    } else {
+      // <0,VALUE>
+      if (write_literal (out, buf[p]) != 0) return -1;
+      step = 1;
+      if (level->skip && ++misses >> level->skip) {
+        // Likely incompressible, write the next bytes without searching them
+        insert_to (finder, buf, &inserted, p + 1, limit);
+        for (step = 1 + (misses >> level->skip); step > 1 && p + 1 < end;
+            step--) {
+          if (write_literal (out, buf[++p]) != 0) return -1;
+        }
+        inserted = ++p;
+        matched = -1;
+        continue;
+      }
+    }
+
+    // Insert patterns starting at every byte compressed into the chains
+    p += step;
+    insert_to (finder, buf, &inserted, p, limit);
+    matched = -1;
   }
+  return 0;
 }
 
-int find_longest_prefix_match (
-    hash_t *hash, uint8_t *key, int key_len, uint64_t *value
-    ) {
-  int i;
-  for (i = key_len; i > 1; i--) {
-    if (hash_lookup (hash, key, i, value) == 0) return i;
+/* Compress the bytes of buf from *pos up to end like compress_span,
+ * picking the commands that take the fewest bits over chunks of
+ * OPTIMAL_CHUNK bytes. A <0,VALUE> takes LITERAL_BITS and a
+ * <1,POINTER,LENGTH> POINTER_BITS whatever its length, and every prefix of
+ * a pattern is a pattern at the same distance, so the longest pattern at
+ * each byte is all the parse needs. The fewest bits from each byte to the
+ * end of the chunk are then found walking the chunk backwards.
+ * The last pattern of a chunk may cross its end, and the next chunk then
+ * starts where that pattern ends. The bytes it covers past the end are
+ * credited the fewest bits they could take otherwise, POINTER_BITS for
+ * MAX_MATCH bytes, so costs are counted in 1 / MAX_MATCH of a bit.
+ * On return *pos is the first byte not compressed yet,
+ * which may be past end when the last pattern crosses it.
+ * Return 0 for success and -1 for failure.
+ */
+static int compress_span_optimal (match_finder_t *finder, optimal_t *optimal,
+    const uint8_t *buf, uint32_t *pos, uint32_t end, uint32_t limit,
+    bit_out_stream_t *out) {
+  int len, length;
+  uint32_t i, n, p, inserted, distance, cost;
+
+  distance = 0;
+  for (p = *pos, inserted = p; p < end; *pos = p) {
+    n = end - p < OPTIMAL_CHUNK ? end - p : OPTIMAL_CHUNK;
+
+    // Longest pattern at every byte, reading up to limit
+    for (i = 0; i < n; i++) {
+      optimal->length[i] = find_pattern (finder, buf, p + i, MAX_MATCH,
+          limit - p - i, &distance);
+      optimal->distance[i] = distance;
+      insert_to (finder, buf, &inserted, p + i + 1, limit);
+    }
+
+    // Fewest bits from every byte to the end of the chunk, a pointer
+    // is preferred to a literal when both take as many bits. Every parse
+    // ends at one of the MAX_MATCH bytes from the end, each ending further
+    // getting POINTER_BITS less.
+    for (i = 0; i < MAX_MATCH; i++) {
+      optimal->cost[n + i] = (MAX_MATCH - i) * POINTER_BITS;
+    }
+    for (i = n; i-- > 0;) {
+      length = 1;
+      cost = LITERAL_BITS * MAX_MATCH + optimal->cost[i + 1];
+      for (len = optimal->length[i]; len >= MIN_MATCH; len--) {
+        if (POINTER_BITS * MAX_MATCH + optimal->cost[i + len] <= cost) {
+          cost = POINTER_BITS * MAX_MATCH + optimal->cost[i + len];
+          length = len;
+        }
+      }
+      optimal->cost[i] = cost;
+      optimal->length[i] = length;
+    }
+
+    // Write compressed data
+    for (i = 0; i < n; i += optimal->length[i]) {
+      if (optimal->length[i] > 1) {
+        // <1,POINTER,LENGTH>
+        if (write_pointer (out, optimal->distance[i], optimal->length[i])
+            != 0) return -1;
+      } else {
+        // <0,VALUE>
+        if (write_literal (out, buf[p + i]) != 0) return -1;
+      }
+    }
+    p += i;
+    insert_to (finder, buf, &inserted, p, limit);
   }
   return 0;
 }
 
-void compress_file (FILE *in, FILE *out) {
-  int c, matched, skip;
-  uint8_t byte, *key;
-  uint16_t pointer;
-  uint64_t compressed, value;
+/* Compress the bytes of buf from *pos up to end as level says, with the
+ * optimal parse when optimal is not NULL. See compress_span.
+ */
+static int compress_level_span (match_finder_t *finder, const level_t *level,
+    optimal_t *optimal, const uint8_t *buf, uint32_t *pos, uint32_t end,
+    uint32_t limit, bit_out_stream_t *out) {
+  if (optimal) {
+    return compress_span_optimal (finder, optimal, buf, pos, end, limit, out);
+  }
+  return compress_span (finder, level, buf, pos, end, limit, out);
+}
+
+/* Compress in to out at level, between COMPRESS_MIN_LEVEL for speed and
+ * COMPRESS_MAX_LEVEL for ratio. Both files are closed.
+ * Return 0 for success and -1 for failure.
+ */
+int compress_file (FILE *in, FILE *out, int level) {
+  return compress_file_dict (in, out, level, NULL, 0);
+}
+
+/* Compress in to out at level as for compress_file, pointing into the
+ * dict_len bytes of dict as if they came before in.
+ */
+int compress_file_dict (FILE *in, FILE *out, int level,
+    const uint8_t *dict, size_t dict_len) {
+  int eof, result;
+  uint8_t *buf;
+  uint32_t pos, end, filled, shift, primed;
+  uint64_t dropped, file_size;
+  size_t n;
   struct stat file_stat;
   bit_out_stream_t *out_stream;
-  hash_t *hash;
-  queue_t *pointable, *pending;
+  match_finder_t *finder;
+  optimal_t *optimal;
+  const level_t *params = get_level (level);
+  STATS_TIMER (start);
+  STATS_TIMER (read_start);
+
+  STATS_START (start);
+  // The size is only used to report progress, unknown for pipes
+  file_size = 0;
+  if (fstat (fileno (in), &file_stat) == 0 && S_ISREG (file_stat.st_mode)) {
+    file_size = file_stat.st_size;
+  }
 
-  if (fstat (fileno (in), &file_stat) != 0) {
-    perror ("fstat");
+  // Flat buffer holding the pointable window followed by pending bytes
+  buf = malloc (IN_BUF_SIZE);
+  finder = level_finder_new (params);
+  optimal = params->optimal ? malloc (sizeof (optimal_t)) : NULL;
+  if (!buf || !finder || (params->optimal && !optimal)) {
+    perror ("malloc");
+    free (buf);
+    free (optimal);
+    if (finder) match_finder_destroy (&finder);
     fclose (in);
     fclose (out);
-    return;
+    return -1;
+  }
+  out_stream = bit_out_stream_new (out, 0);
+  dropped = 0;
+  filled = 0;
+  pos = 0;
+
+  // The input starts after a whole window holding the dictionary
+  primed = 0;
+  if (dict_len) {
+    prime_window (finder, buf, dict, dict_len);
+    primed = PTR_SIZE;
+    filled = PTR_SIZE;
+    pos = PTR_SIZE;
   }
 
-  // Buffer pointable compressed bytes
-  pointable = queue_new (PTR_SIZE);
-  // <pointer,len> can be <0,15>
-  pending = queue_new (0xF);
-  out_stream = bit_out_stream_new (out);
-  hash = hash_new (PTR_SIZE * 14);
-  compressed = 0;
+  fprintf (stderr, "Compressing...\n");
+  result = 0;
+  do {
+    if (filled == IN_BUF_SIZE) {
+      // Drop whole windows that can no longer be pointed to
+      shift = (pos - PTR_SIZE) & ~(PTR_SIZE - 1);
+      memmove (buf, buf + shift, filled - shift);
+      match_finder_shift (finder, shift);
+      dropped += shift;
+      filled -= shift;
+      pos -= shift;
+    }
+    STATS_START (read_start);
+    n = fread (buf + filled, 1, IN_BUF_SIZE - filled, in);
+    STATS_STOP (read_time, read_start);
+    STATS_ADD (bytes_in, n);
+    filled += n;
+    eof = (n == 0);
+    if (eof && ferror (in)) {
+      perror ("fread");
+      result = -1;
+      break;
+    }
 
-  printf ("Compressing...\n");
-  while ((c = fgetc (in)) != EOF || pending->length) {
-    if (compressed % 0x100 == 0) {
-      printf ("%ld%%\r", compressed * 100 / file_stat.st_size);
+    // Keep a full pattern of pending bytes unless finished reading from file
+    end = eof ? filled : filled > MAX_MATCH ? filled - MAX_MATCH : 0;
+    if (compress_level_span (finder, params, optimal, buf, &pos, end, filled,
+          out_stream) != 0) {
+      perror ("fwrite");
+      result = -1;
+      break;
     }
+    progress_report (dropped + pos - primed, file_size, eof);
+  } while (!eof);
+  if (result == 0 && bit_out_stream_flush (out_stream) != 0) {
+    perror ("fwrite");
+    result = -1;
+  }
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
 
-    // Compress a byte if queue pending is full or finished reading from file
-    if (pending->length == pending->size || c == EOF) {
-      // Find the longest prefix match
-      key = queue_sub_array (pending, 0, pending->length);
-      matched = find_longest_prefix_match (hash, key, pending->length, &value);
+  bit_out_stream_destroy (&out_stream);
+  match_finder_destroy (&finder);
+  free (optimal);
+  free (buf);
+  fclose (in);
+  STATS_STOP (compress_time, start);
+  STATS_FOLD ();
+  return result;
+}
 
-      // Insert subarrays starting at this byte into hash table
-      insert_queue_head_prefixes (hash, key, pending->length, compressed + 1);
-      free (key);
+/* Maximum size of compressing len bytes:
+ * every byte written as a 9 bits <0,VALUE>, padded to a whole byte.
+ */
+size_t compress_bound (size_t len) {
+  return len + (len + 7) / 8;
+}
 
-      queue_pop (pending, &byte);
-      // printf ("processing '%c': ", byte);
+/* Compress the len bytes at src from src[pos] on to out as level says,
+ * with the optimal parse when optimal is not NULL. Every byte before pos
+ * must already be linked into the chains.
+ * Return 0 for success and -1 for failure.
+ */
+static int compress_buffer_from (match_finder_t *finder,
+    const level_t *params, optimal_t *optimal, const uint8_t *src,
+    size_t len, uint32_t pos, bit_out_stream_t *out) {
+  uint32_t end, limit, shift;
 
-      if (skip > 0) {
-        // This byte is already compressed
-        skip -= 1;
+  while (pos < len) {
+    if (pos >= BUFFER_SPAN) {
+      // Keep positions small by moving the start of the buffer forward
+      shift = (pos - PTR_SIZE) & ~(PTR_SIZE - 1);
+      match_finder_shift (finder, shift);
+      src += shift;
+      len -= shift;
+      pos -= shift;
+    }
+    end = len < BUFFER_SPAN ? len : BUFFER_SPAN;
+    limit = len < end + MAX_MATCH ? len : end + MAX_MATCH;
+    if (compress_level_span (finder, params, optimal, src, &pos, end, limit,
+          out) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
 
-      } else {
-        // Write compressed data
-        if (matched && compressed >= value) {
-          pointer = compressed - value;
-          if (write_1bit (out_stream, 1) != 0) break;
-          if (write_12bits (out_stream, pointer) != 0) break;
-          if (write_4bits (out_stream, matched) != 0) break;
-          // printf ("<1,%d,%d>\n", pointer, matched);
-
-          skip = matched - 1;
-
-        } else {
-          if (write_1bit (out_stream, 0) != 0) break;
-          if (write_8bits (out_stream, byte) != 0) break;
-          // printf ("<0,'%c'>\n", byte);
-        }
-      }
-      compressed += 1;
-
-      if (pointable->length == pointable->size) {
-        // Remove all subarrays with lengths between 2 and 15 begining with
-        // the oldest byte in queue pointable and has a value less than 
-        // [compressed - PTR_SIZE] from the hash table
-        key = queue_sub_array (pointable, 0, 0xF);
-        delete_queue_head_prefixes (hash, key, 0xF, compressed - PTR_SIZE);
-        free (key);
-      }
-      queue_add (pointable, byte);
+/* A compression context kept by a caller compressing many inputs: the
+ * match finder, reset in O(1) after each input, the scratch space of the
+ * optimal parse once a level needs it and the window the start of an input
+ * is compressed from once a dictionary is given. A context holds no global
+ * state, so every thread of a pool can keep its own.
+ */
+struct lz77_cctx {
+  match_finder_t *finder;
+  optimal_t *optimal;
+  uint8_t *window;
+};
+
+/* Create a context compressing one buffer at a time at any level.
+ * Return NULL for failure.
+ */
+lz77_cctx_t* lz77_cctx_new () {
+  lz77_cctx_t *ctx;
+
+  ctx = calloc (1, sizeof (lz77_cctx_t));
+  if (!ctx) {
+    return NULL;
+  }
+  ctx->finder = match_finder_new (PTR_SIZE, 1, MAX_MATCH);
+  if (!ctx->finder) {
+    lz77_cctx_destroy (&ctx);
+  }
+  return ctx;
+}
+
+void lz77_cctx_destroy (lz77_cctx_t **ctx_ptr) {
+  lz77_cctx_t *ctx = *ctx_ptr;
+  if (ctx->finder) match_finder_destroy (&ctx->finder);
+  free (ctx->optimal);
+  free (ctx->window);
+  free (ctx);
+  *ctx_ptr = NULL;
+}
+
+/* Compress as compress_buffer_dict with the tables of ctx, dict being NULL
+ * when dict_len is 0. Nothing of the input is remembered afterwards.
+ */
+int lz77_cctx_compress (lz77_cctx_t *ctx, const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level,
+    const uint8_t *dict, size_t dict_len) {
+  uint64_t bits;
+
+  if (lz77_cctx_compress_bits (ctx, src, len, dst, dst_size, &bits, level,
+        dict, dict_len) != 0) {
+    return -1;
+  }
+  *dst_len = (bits + 7) / 8;
+  return 0;
+}
+
+/* Compress as lz77_cctx_compress, putting the number of bits of the stream
+ * in dst_bits, the padding of its last byte left out.
+ */
+int lz77_cctx_compress_bits (lz77_cctx_t *ctx, const uint8_t *src,
+    size_t len, uint8_t *dst, size_t dst_size, uint64_t *dst_bits, int level,
+    const uint8_t *dict, size_t dict_len) {
+  int result;
+  uint32_t pos, end, head, top;
+  uint8_t *window;
+  bit_out_stream_t *out_stream;
+  match_finder_t *finder = ctx->finder;
+  const level_t *params = get_level (level);
+  STATS_TIMER (start);
+
+  STATS_START (start);
+  if (params->optimal && !ctx->optimal) {
+    ctx->optimal = malloc (sizeof (optimal_t));
+    if (!ctx->optimal) {
+      return -1;
     }
+  }
+  if (dict_len && !ctx->window) {
+    ctx->window = malloc (2 * PTR_SIZE + MAX_MATCH);
+    if (!ctx->window) {
+      return -1;
+    }
+  }
+  window = ctx->window;
+  out_stream = bit_out_stream_new_buffer (dst, dst_size);
+  if (!out_stream) {
+    return -1;
+  }
+  finder->max_chain = params->max_chain;
+  finder->good_len = params->good_len;
 
-    if (c != EOF) {
-      // Read a byte from file
-      queue_add (pending, c);
+  result = 0;
+  pos = 0;
+  // Positions used go up to top, BUFFER_SPAN + MAX_MATCH at most
+  top = len < BUFFER_SPAN + MAX_MATCH ? len : BUFFER_SPAN + MAX_MATCH;
+  if (dict_len && len) {
+    // Only the first PTR_SIZE bytes can point into the dictionary, they are
+    // compressed from a copy following it. Positions of src are then those
+    // of window less PTR_SIZE, which also drops the dictionary.
+    head = len < PTR_SIZE + MAX_MATCH ? len : PTR_SIZE + MAX_MATCH;
+    end = len < PTR_SIZE ? len : PTR_SIZE;
+    prime_window (finder, window, dict, dict_len);
+    memcpy (window + PTR_SIZE, src, head);
+    pos = PTR_SIZE;
+    result = compress_level_span (finder, params,
+        params->optimal ? ctx->optimal : NULL, window, &pos,
+        PTR_SIZE + end, PTR_SIZE + head, out_stream);
+    pos -= PTR_SIZE;
+    if (pos < len) {
+      match_finder_shift (finder, PTR_SIZE);
     }
+    if (top < PTR_SIZE + head) top = PTR_SIZE + head;
+  }
+  if (result == 0) {
+    result = compress_buffer_from (finder, params,
+        params->optimal ? ctx->optimal : NULL, src, len, pos, out_stream);
   }
-  printf("Done\n");
+  match_finder_reset (finder, top);
 
+  *dst_bits = (uint64_t) out_stream->block_len * 8 + out_stream->bit_count;
+  if (result != 0 || bit_out_stream_flush (out_stream) != 0) {
+    result = -1;
+  }
   bit_out_stream_destroy (&out_stream);
-  hash_destroy (&hash);
-  queue_destroy (&pointable);
-  queue_destroy (&pending);
-  fclose (in);
+  STATS_ADD (bytes_in, len);
+  STATS_ADD (bytes_out, result == 0 ? (*dst_bits + 7) / 8 : 0);
+  STATS_STOP (compress_time, start);
+  STATS_FOLD ();
+  return result;
 }
 
-void decompress_file (FILE *in, FILE *out) {
-  uint8_t op_bit, byte, length, *copy, i;
-  uint16_t pointer;
+/* Compress the len bytes at src into dst, which can hold dst_size bytes,
+ * at level as for compress_file. The compressed size is put in dst_len.
+ * Return 0 for success and -1 for failure, including dst being too small;
+ * a dst of compress_bound (len) bytes is always large enough.
+ */
+int compress_buffer (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level) {
+  return compress_buffer_dict (src, len, dst, dst_size, dst_len, level,
+      NULL, 0);
+}
+
+/* Compress as compress_buffer, pointing into the dict_len bytes of dict as
+ * if they came before src. Callers compressing many buffers should keep an
+ * lz77_cctx_t instead, which spares setting up the tables every time.
+ */
+int compress_buffer_dict (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level,
+    const uint8_t *dict, size_t dict_len) {
+  int result;
+  lz77_cctx_t *ctx;
+
+  ctx = lz77_cctx_new ();
+  if (!ctx) {
+    return -1;
+  }
+  result = lz77_cctx_compress (ctx, src, len, dst, dst_size, dst_len, level,
+      dict, dict_len);
+  lz77_cctx_destroy (&ctx);
+  return result;
+}
+
+/* Maximum size of decompressing len bytes: every POINTER_BITS a
+ * <1,POINTER,MAX_MATCH>, with as many <0,VALUE> as fit in the bits left.
+ */
+size_t decompress_bound (size_t len) {
+  return len * 8 / POINTER_BITS * MAX_MATCH
+    + len * 8 % POINTER_BITS / LITERAL_BITS;
+}
+
+/* Copy the length bytes of a pattern from distance bytes before dst to dst,
+ * where the pattern may overlap its own output. Writes 16 bytes at a time,
+ * up to WIDE_COPY bytes, so dst must be writable up to dst + WIDE_COPY.
+ */
+static inline void copy_match (uint8_t *dst, uint32_t distance,
+    uint32_t length) {
+  uint8_t pattern[16];
+  uint32_t n, step;
+  const uint8_t *src = dst - distance;
+
+  if (distance >= 8) {
+    // Whole words never overlap the part of the output still being copied
+    n = 0;
+    do {
+      memcpy (dst + n, src + n, 8);
+      memcpy (dst + n + 8, src + n + 8, 8);
+      n += 16;
+    } while (MAX_MATCH > 16 && n < length);
+  } else if (distance == 1) {
+    // A run of the last byte
+    memset (dst, *src, WIDE_COPY);
+  } else {
+    // Repeat the short period until the pattern holds 16 bytes
+    memcpy (pattern, src, distance);
+    for (n = distance; n < 16; n *= 2) {
+      memcpy (pattern + n, pattern, n < 16 - n ? n : 16 - n);
+    }
+    memcpy (dst, pattern, 16);
+    // Then copy words from a whole number of periods back, 8 bytes or more
+    for (step = distance; step < 8; step += distance);
+    for (n = 16; MAX_MATCH > 16 && n < length; n += 8) {
+      memcpy (dst + n, dst + n - step, 8);
+    }
+  }
+}
+
+/* Decompress commands from in into dst starting at dst[*pos] while *pos is
+ * less than end; dst must be writable up to end + WIDE_COPY.
+ * Pointers may reach back up to the start of dst.
+ * Return 1 if the stream is finished, 0 if *pos reached end,
+ * -1 for a pointer before the start of dst.
+ */
+static int decompress_span (bit_in_stream_t *in, uint8_t *dst,
+    size_t *pos, size_t end) {
+  int available;
+  uint32_t command, pointer, length;
+  size_t n;
+
+  for (n = *pos; n < end; *pos = n) {
+    // One refill covers the flag bit and the payload of a command
+    available = bit_in_refill (in);
+    if (available < LITERAL_BITS) return 1;
+    command = bit_in_peek (in, POINTER_BITS);
+
+    if (!(command >> (POINTER_BITS - 1))) {
+      dst[n++] = command >> (POINTER_BITS - LITERAL_BITS);
+      bit_in_consume (in, LITERAL_BITS);
+
+    } else {
+      if (available < POINTER_BITS) return 1;
+      bit_in_consume (in, POINTER_BITS);
+      pointer = (command >> LENGTH_BITS) & (PTR_SIZE - 1);
+      if (pointer >= n) return -1;
+      length = (command & ((1 << LENGTH_BITS) - 1)) + LENGTH_BIAS;
+      copy_match (dst + n, pointer + 1, length);
+      n += length;
+    }
+  }
+  return 0;
+}
+
+int decompress_file (FILE *in, FILE *out) {
+  return decompress_file_dict (in, out, NULL, 0);
+}
+
+/* Decompress in to out, where in was compressed with the dict_len bytes of
+ * dict as for compress_file_dict. Both files are closed.
+ * Return 0 for success and -1 for failure: an invalid pointer, a stream
+ * cut short or a failed write.
+ */
+int decompress_file_dict (FILE *in, FILE *out,
+    const uint8_t *dict, size_t dict_len) {
+  int result;
+  uint8_t *buf;
+  size_t pos, start, written;
   bit_in_stream_t *in_stream;
-  queue_t *queue;
+  STATS_TIMER (time_start);
+  STATS_TIMER (write_start);
 
+  STATS_START (time_start);
   in_stream = bit_in_stream_new (in);
-  queue = queue_new (PTR_SIZE);
+  // Flat buffer holding the pointable window followed by new output
+  buf = malloc (OUT_BUF_SIZE + WIDE_COPY);
+  if (!in_stream || !buf) {
+    perror ("decompress_file");
+    free (buf);
+    if (in_stream) {
+      bit_in_stream_destroy (&in_stream);
+    } else {
+      fclose (in);
+    }
+    fclose (out);
+    return -1;
+  }
+  pos = prime_history (buf, dict, dict_len);
 
-  printf ("Decompressing...\n");
-  while (read_1bit (in_stream, &op_bit) == 0) {
-    if (in_stream->read % 0x100 == 0) {
-      printf ("%ld%%\r", in_stream->read * 100 / in_stream->file_size);
+  fprintf (stderr, "Decompressing...\n");
+  do {
+    start = pos;
+    result = decompress_span (in_stream, buf, &pos, OUT_BUF_SIZE);
+    if (result < 0) {
+      fprintf (stderr, "Invalid pointer at byte %ld\n", in_stream->read);
+    }
+    STATS_START (write_start);
+    written = fwrite (buf + start, 1, pos - start, out);
+    STATS_STOP (write_time, write_start);
+    STATS_ADD (bytes_out, written);
+    if (written != pos - start) {
+      perror ("fwrite");
+      result = -1;
+      break;
     }
-    if (!op_bit) {
-      if (read_8bits (in_stream, &byte) != 0) break;
-      // printf ("<0,'%c'>\n", byte);
-      queue_add (queue, byte);
-      fputc (byte, out);
+    progress_report (in_stream->read, in_stream->file_size, result != 0);
+
+    // Only the last PTR_SIZE bytes can still be pointed to
+    if (pos > PTR_SIZE) {
+      memmove (buf, buf + pos - PTR_SIZE, PTR_SIZE);
+      pos = PTR_SIZE;
+    }
+  } while (result == 0);
+
+  // The end of a stream is where its input ends: padding is less than the
+  // 9 bits of any command and only 0s, anything else was cut short
+  if (result == 1 && (in_stream->bit_count >= 8 || in_stream->bits)) {
+    fprintf (stderr, "Truncated file\n");
+    result = -1;
+  }
+
+  bit_in_stream_destroy (&in_stream);
+  free (buf);
+  if (fclose (out) != 0) {
+    perror ("fclose");
+    result = -1;
+  }
+  fprintf (stderr, result == 1 ? "Done\n" : "Failed\n");
+  STATS_STOP (decompress_time, time_start);
+  STATS_FOLD ();
+  return result == 1 ? 0 : -1;
+}
+
+/* Decompress commands from in into dst, which can hold dst_size bytes,
+ * from dst[*pos] on until the end of the stream. Pointers may reach back up
+ * to the start of dst. The decompressed size is put in pos.
+ * Return 0 for success and -1 for failure: dst being too small,
+ * a pointer to before the start of dst or a stream cut short.
+ */
+static int decompress_buffer_from (bit_in_stream_t *in_stream, uint8_t *dst,
+    size_t dst_size, size_t *pos) {
+  int result, available;
+  uint32_t command, pointer, length, i;
+  size_t n;
+
+  // Wide copies while dst has room for them, then exact copies near its end
+  n = *pos;
+  result = 0;
+  if (dst_size >= WIDE_COPY) {
+    result = decompress_span (in_stream, dst, &n, dst_size - WIDE_COPY);
+  }
+  // Commands are only consumed whole, so what is left at the end of the
+  // stream is the padding or a command cut short
+  while (result == 0) {
+    available = bit_in_refill (in_stream);
+    if (available < LITERAL_BITS) break;
+    if (!bit_in_peek (in_stream, 1)) {
+      if (n == dst_size) {
+        result = -1;
+        break;
+      }
+      dst[n++] = bit_in_peek (in_stream, LITERAL_BITS);
+      bit_in_consume (in_stream, LITERAL_BITS);
 
     } else {
-      if (read_12bits (in_stream, &pointer) != 0) break;
-      if (read_4bits (in_stream, &length) != 0) break;
-      // printf ("<1,%d,%d>\n", pointer, length);
-
-      // Check if the queue has buffered enough bytes to copy
-      if (length > pointer + 1) {
-        for (i = 0; i < length; i++) {
-          queue_get (queue, queue->length - 1 - pointer, &byte);
-          queue_add (queue, byte);
-          fputc (byte, out);
-        }
-      } else {
-        copy = queue_sub_array (queue, queue->length - 1 - pointer, length);
-        for (i = 0; i < length; i++) {
-          queue_add (queue, copy[i]);
-        }
-        fwrite (copy, 1, length, out);
-        free (copy);
+      if (available < POINTER_BITS) break;
+      command = bit_in_peek (in_stream, POINTER_BITS);
+      bit_in_consume (in_stream, POINTER_BITS);
+      pointer = (command >> LENGTH_BITS) & (PTR_SIZE - 1);
+      length = (command & ((1 << LENGTH_BITS) - 1)) + LENGTH_BIAS;
+      if (pointer >= n || length > dst_size - n) {
+        result = -1;
+        break;
+      }
+      // Copy one byte at a time, the pattern may overlap its own output
+      for (i = 0; i < length; i++, n++) {
+        dst[n] = dst[n - 1 - pointer];
       }
     }
   }
-  printf("Done\n");
+  *pos = n;
+
+  // Only the padding of the last byte, all 0s, can be left
+  if (result >= 0 && (in_stream->bit_count >= 8 || in_stream->bits)) {
+    result = -1;
+  }
+  return result < 0 ? -1 : 0;
+}
+
+/* Decompress the len bytes at src into dst, which can hold dst_size bytes.
+ * The decompressed size is put in dst_len.
+ * Return 0 for success and -1 for failure: dst being too small,
+ * a pointer to before the start of the output or src cut short.
+ */
+int decompress_buffer (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len) {
+  return decompress_buffer_dict (src, len, dst, dst_size, dst_len, NULL, 0);
+}
+
+/* Decompress as decompress_buffer, where src was compressed with the
+ * dict_len bytes of dict as for compress_buffer_dict.
+ */
+int decompress_buffer_dict (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len,
+    const uint8_t *dict, size_t dict_len) {
+  int result;
+  uint8_t *window;
+  size_t n, primed;
+  bit_in_stream_t *in_stream;
+  STATS_TIMER (start);
+
+  STATS_START (start);
+  in_stream = bit_in_stream_new_buffer (src, len);
+  if (!in_stream) {
+    return -1;
+  }
 
+  n = 0;
+  result = 0;
+  if (dict_len) {
+    // Only the first PTR_SIZE bytes can point into the dictionary, they are
+    // decompressed after a copy of it and then moved to dst
+    window = malloc (2 * PTR_SIZE + MAX_MATCH + WIDE_COPY);
+    if (!window) {
+      bit_in_stream_destroy (&in_stream);
+      return -1;
+    }
+    primed = prime_history (window, dict, dict_len);
+    n = primed;
+    result = decompress_span (in_stream, window, &n, primed + PTR_SIZE);
+    n -= primed;
+    if (n > dst_size) {
+      result = -1;
+    } else {
+      memcpy (dst, window + primed, n);
+    }
+    free (window);
+  }
+  if (result == 0) {
+    result = decompress_buffer_from (in_stream, dst, dst_size, &n);
+  } else if (result == 1
+      && (in_stream->bit_count >= 8 || in_stream->bits)) {
+    // The stream ended within the first PTR_SIZE bytes, as there only the
+    // padding of the last byte, all 0s, can be left
+    result = -1;
+  }
+
+  *dst_len = n;
   bit_in_stream_destroy (&in_stream);
-  queue_destroy (&queue);
-  fclose (out);
+  STATS_ADD (bytes_in, len);
+  STATS_ADD (bytes_out, n);
+  STATS_STOP (decompress_time, start);
+  STATS_FOLD ();
+  return result < 0 ? -1 : 0;
 }
 
+/* State of a compression driven one call at a time: a flat buffer holding
+ * the pointable window followed by the input not compressed yet, as in
+ * compress_file, and the compressed bytes not handed to the caller yet.
+ */
+struct lz77_cstream {
+  const level_t *level;
+  match_finder_t *finder;
+  optimal_t *optimal;
+  uint8_t *buf;
+  uint32_t pos;
+  uint32_t filled;
+
+  // Compressed bytes are out->block[out_pos] to out->block[out->block_len - 1]
+  bit_out_stream_t *out;
+  size_t out_pos;
+  int finished;
+};
+
+/* State of a decompression driven one call at a time: a flat buffer holding
+ * the pointable window followed by the output not handed to the caller yet,
+ * from buf[out_pos] to buf[pos - 1], and the bits of a partial command.
+ */
+struct lz77_dstream {
+  bit_in_stream_t *in;
+  uint8_t *buf;
+  size_t pos;
+  size_t out_pos;
+};
+
+/* Create a stream compressing at level as for compress_file.
+ * Return NULL for failure.
+ */
+lz77_cstream_t* lz77_cstream_new (int level) {
+  lz77_cstream_t *stream;
+  uint8_t *pending;
+
+  stream = calloc (1, sizeof (lz77_cstream_t));
+  if (!stream) {
+    return NULL;
+  }
+  stream->level = get_level (level);
+  stream->finder = level_finder_new (stream->level);
+  stream->optimal = stream->level->optimal ? malloc (sizeof (optimal_t))
+    : NULL;
+  stream->buf = malloc (IN_BUF_SIZE);
+  // A whole buffer of input compresses to at most its bound, plus a word
+  // of slack for draining the bits
+  pending = malloc (compress_bound (IN_BUF_SIZE) + 8);
+  stream->out = pending
+    ? bit_out_stream_new_buffer (pending, compress_bound (IN_BUF_SIZE) + 8)
+    : NULL;
+  if (!stream->finder || (stream->level->optimal && !stream->optimal)
+      || !stream->buf || !stream->out) {
+    if (!stream->out) free (pending);
+    lz77_cstream_destroy (&stream);
+  }
+  return stream;
+}
+
+void lz77_cstream_destroy (lz77_cstream_t **stream_ptr) {
+  lz77_cstream_t *stream = *stream_ptr;
+  if (stream->finder) match_finder_destroy (&stream->finder);
+  if (stream->out) {
+    free (stream->out->block);
+    free (stream->out);
+  }
+  free (stream->optimal);
+  free (stream->buf);
+  free (stream);
+  *stream_ptr = NULL;
+}
+
+/* Have stream point into the dict_len bytes of dict as if they came before
+ * its input, as for compress_buffer_dict. Only allowed before any input.
+ * Return 0 for success and -1 for failure.
+ */
+int lz77_cstream_set_dict (lz77_cstream_t *stream, const uint8_t *dict,
+    size_t dict_len) {
+  if (stream->filled || stream->finished) {
+    return -1;
+  }
+  if (dict_len) {
+    prime_window (stream->finder, stream->buf, dict, dict_len);
+    stream->filled = PTR_SIZE;
+    stream->pos = PTR_SIZE;
+  }
+  return 0;
+}
+
+/* Hand the compressed bytes of stream to dst, which can hold dst_cap bytes,
+ * after the *dst_used bytes already there.
+ * Return 1 if every compressed byte was handed over, 0 otherwise.
+ */
+static int cstream_deliver (lz77_cstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used) {
+  size_t n = stream->out->block_len - stream->out_pos;
+
+  if (n > dst_cap - *dst_used) n = dst_cap - *dst_used;
+  memcpy (dst + *dst_used, stream->out->block + stream->out_pos, n);
+  *dst_used += n;
+  STATS_ADD (bytes_out, n);
+  stream->out_pos += n;
+  if (stream->out_pos < stream->out->block_len) {
+    return 0;
+  }
+  stream->out->block_len = 0;
+  stream->out_pos = 0;
+  return 1;
+}
+
+/* Compress the src_len bytes at src to dst, which can hold dst_cap bytes.
+ * The number of bytes of src taken is put in src_used and the number of
+ * bytes written to dst in dst_used. Input is only taken while the output
+ * of earlier calls fits in dst, and the last MAX_MATCH bytes taken are held
+ * back until more input or lz77_cstream_finish says how patterns end.
+ * Return 0 for success and -1 for failure.
+ */
+int lz77_cstream_update (lz77_cstream_t *stream, const uint8_t *src,
+    size_t src_len, size_t *src_used, uint8_t *dst, size_t dst_cap,
+    size_t *dst_used) {
+  uint32_t n, end, shift;
+
+  *src_used = 0;
+  *dst_used = 0;
+  if (stream->finished) {
+    return src_len ? -1 : 0;
+  }
+  while (cstream_deliver (stream, dst, dst_cap, dst_used)
+      && *src_used < src_len) {
+    if (stream->filled == IN_BUF_SIZE) {
+      // Drop whole windows that can no longer be pointed to
+      shift = (stream->pos - PTR_SIZE) & ~(PTR_SIZE - 1);
+      memmove (stream->buf, stream->buf + shift, stream->filled - shift);
+      match_finder_shift (stream->finder, shift);
+      stream->filled -= shift;
+      stream->pos -= shift;
+    }
+    n = IN_BUF_SIZE - stream->filled;
+    if (n > src_len - *src_used) n = src_len - *src_used;
+    memcpy (stream->buf + stream->filled, src + *src_used, n);
+    stream->filled += n;
+    *src_used += n;
+    STATS_ADD (bytes_in, n);
+
+    // Keep a full pattern of pending bytes, and whole chunks for the optimal
+    // parse while there is room for more
+    end = stream->filled > MAX_MATCH ? stream->filled - MAX_MATCH : 0;
+    if (stream->optimal && stream->filled < IN_BUF_SIZE && end > stream->pos) {
+      end -= (end - stream->pos) % OPTIMAL_CHUNK;
+    }
+    if (compress_level_span (stream->finder, stream->level, stream->optimal,
+          stream->buf, &stream->pos, end, stream->filled, stream->out) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Compress the bytes held back by stream and end the compressed stream,
+ * writing to dst, which can hold dst_cap bytes. The number of bytes
+ * written is put in dst_used. No more input can be given afterwards.
+ * Return 0 once every compressed byte was written, 1 if dst was too small
+ * and this must be called again, -1 for failure.
+ */
+int lz77_cstream_finish (lz77_cstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used) {
+  *dst_used = 0;
+  if (!cstream_deliver (stream, dst, dst_cap, dst_used)) {
+    return 1;
+  }
+  if (!stream->finished) {
+    stream->finished = 1;
+    if (compress_level_span (stream->finder, stream->level, stream->optimal,
+          stream->buf, &stream->pos, stream->filled, stream->filled,
+          stream->out) != 0
+        || bit_out_stream_flush (stream->out) != 0) {
+      return -1;
+    }
+  }
+  return cstream_deliver (stream, dst, dst_cap, dst_used) ? 0 : 1;
+}
+
+/* Create a stream decompressing a headerless stream.
+ * Return NULL for failure.
+ */
+lz77_dstream_t* lz77_dstream_new () {
+  lz77_dstream_t *stream;
+
+  stream = calloc (1, sizeof (lz77_dstream_t));
+  if (!stream) {
+    return NULL;
+  }
+  stream->in = bit_in_stream_new_buffer (NULL, 0);
+  stream->buf = malloc (OUT_BUF_SIZE + WIDE_COPY);
+  if (!stream->in || !stream->buf) {
+    lz77_dstream_destroy (&stream);
+  }
+  return stream;
+}
+
+void lz77_dstream_destroy (lz77_dstream_t **stream_ptr) {
+  lz77_dstream_t *stream = *stream_ptr;
+  if (stream->in) bit_in_stream_destroy (&stream->in);
+  free (stream->buf);
+  free (stream);
+  *stream_ptr = NULL;
+}
+
+/* Have stream decompress a stream compressed with the dict_len bytes of
+ * dict, as for decompress_buffer_dict. Only allowed before any input.
+ * Return 0 for success and -1 for failure.
+ */
+int lz77_dstream_set_dict (lz77_dstream_t *stream, const uint8_t *dict,
+    size_t dict_len) {
+  if (stream->pos || stream->in->read || stream->in->bit_count) {
+    return -1;
+  }
+  stream->pos = prime_history (stream->buf, dict, dict_len);
+  stream->out_pos = stream->pos;
+  return 0;
+}
+
+/* Hand the decompressed bytes of stream to dst as cstream_deliver does,
+ * making room in its buffer once they are all handed over.
+ * Return 1 if every decompressed byte was handed over, 0 otherwise.
+ */
+static int dstream_deliver (lz77_dstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used) {
+  size_t n = stream->pos - stream->out_pos;
+
+  if (n > dst_cap - *dst_used) n = dst_cap - *dst_used;
+  memcpy (dst + *dst_used, stream->buf + stream->out_pos, n);
+  *dst_used += n;
+  STATS_ADD (bytes_out, n);
+  stream->out_pos += n;
+  if (stream->out_pos < stream->pos) {
+    return 0;
+  }
+
+  // Only the last PTR_SIZE bytes can still be pointed to
+  if (stream->pos >= OUT_BUF_SIZE) {
+    memmove (stream->buf, stream->buf + stream->pos - PTR_SIZE, PTR_SIZE);
+    stream->pos = PTR_SIZE;
+    stream->out_pos = PTR_SIZE;
+  }
+  return 1;
+}
+
+/* Decompress the src_len bytes at src to dst, which can hold dst_cap bytes.
+ * The number of bytes of src taken is put in src_used and the number of
+ * bytes written to dst in dst_used. Commands cut short by the end of src
+ * are kept until the next call.
+ * Return 0 for success and -1 for a pointer before the start of the output.
+ */
+int lz77_dstream_update (lz77_dstream_t *stream, const uint8_t *src,
+    size_t src_len, size_t *src_used, uint8_t *dst, size_t dst_cap,
+    size_t *dst_used) {
+  size_t start;
+
+  *dst_used = 0;
+  bit_in_stream_feed (stream->in, src, src_len);
+  while (dstream_deliver (stream, dst, dst_cap, dst_used)) {
+    start = stream->pos;
+    if (decompress_span (stream->in, stream->buf, &stream->pos, OUT_BUF_SIZE)
+        < 0) {
+      *src_used = stream->in->block_pos;
+      STATS_ADD (bytes_in, *src_used);
+      return -1;
+    }
+    if (stream->pos == start) break;
+  }
+  *src_used = stream->in->block_pos;
+  STATS_ADD (bytes_in, *src_used);
+  return 0;
+}
+
+/* Write the bytes decompressed but not written yet to dst, which can hold
+ * dst_cap bytes, once the whole compressed stream was given.
+ * The number of bytes written is put in dst_used.
+ * Return 0 once every byte was written, 1 if dst was too small and this must
+ * be called again, -1 if the compressed stream was cut short.
+ */
+int lz77_dstream_finish (lz77_dstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used) {
+  *dst_used = 0;
+  if (!dstream_deliver (stream, dst, dst_cap, dst_used)) {
+    return 1;
+  }
+  // Only the padding of the last byte, all 0s, can be left
+  if (stream->in->bit_count >= 8 || stream->in->bits != 0) {
+    return -1;
+  }
+  return 0;
+}
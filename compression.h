@@ -1,8 +1,113 @@
 #ifndef SIMPLIFIED_LZ77_H
 #define SIMPLIFIED_LZ77_H
 
-#define PTR_SIZE 0x1000
-void compress_file (FILE *in, FILE *out);
-void decompress_file (FILE *in, FILE *out);
+/* Format presets, picked at build time with make FORMAT=N and recorded in
+ * the format header (see format.h) or the frame header: the bits of the
+ * distance and of the length of a <1,POINTER,LENGTH>, the shortest pattern
+ * pointed to and the bias taken off its length before writing it.
+ * A pointer takes no more bits than the <0,VALUE> of its shortest pattern,
+ * so compress_bound holds for every preset.
+ * 0 is the legacy format, whose 4 bits lengths never use 0 and 1.
+ * Every command is written with field widths known at compile time.
+ */
+#ifndef LZ77_FORMAT
+#define LZ77_FORMAT 0
+#endif
+#if LZ77_FORMAT == 0
+#define WINDOW_BITS 12
+#define LENGTH_BITS 4
+#define MIN_MATCH 2
+#define LENGTH_BIAS 0
+#elif LZ77_FORMAT == 1
+#define WINDOW_BITS 16
+#define LENGTH_BITS 8
+#define MIN_MATCH 3
+#define LENGTH_BIAS 3
+#elif LZ77_FORMAT == 2
+#define WINDOW_BITS 20
+#define LENGTH_BITS 6
+#define MIN_MATCH 3
+#define LENGTH_BIAS 3
+#else
+#error "Unknown LZ77_FORMAT, see the presets of compression.h"
+#endif
+
+#define PTR_SIZE (1 << WINDOW_BITS)
+#define MAX_MATCH ((1 << LENGTH_BITS) - 1 + LENGTH_BIAS)
+
+// Compression levels, from fastest to best ratio,
+// the last one parses optimally
+#define COMPRESS_MIN_LEVEL 1
+#define COMPRESS_DEFAULT_LEVEL 6
+#define COMPRESS_MAX_LEVEL 10
+
+int compress_file (FILE *in, FILE *out, int level);
+int decompress_file (FILE *in, FILE *out);
+size_t compress_bound (size_t len);
+int compress_buffer (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level);
+size_t decompress_bound (size_t len);
+int decompress_buffer (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len);
+
+/* Preset dictionary: bytes known to both sides, pointed to as if they came
+ * right before the data, so short inputs have something to point to.
+ * Only the last PTR_SIZE bytes of a dictionary can be pointed to.
+ * The compressed stream is still headerless, see dict.h for the header
+ * telling which dictionary it needs.
+ */
+int compress_file_dict (FILE *in, FILE *out, int level,
+    const uint8_t *dict, size_t dict_len);
+int decompress_file_dict (FILE *in, FILE *out,
+    const uint8_t *dict, size_t dict_len);
+int compress_buffer_dict (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level,
+    const uint8_t *dict, size_t dict_len);
+int decompress_buffer_dict (const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len,
+    const uint8_t *dict, size_t dict_len);
+
+/* Context compressing one buffer after another without setting up its
+ * tables every time, to be used by one thread at a time
+ */
+typedef struct lz77_cctx lz77_cctx_t;
+
+lz77_cctx_t* lz77_cctx_new ();
+void lz77_cctx_destroy (lz77_cctx_t **ctx_ptr);
+int lz77_cctx_compress (lz77_cctx_t *ctx, const uint8_t *src, size_t len,
+    uint8_t *dst, size_t dst_size, size_t *dst_len, int level,
+    const uint8_t *dict, size_t dict_len);
+/* The number of bits of a stream, without the padding of its last byte,
+ * lets the stream of an input compressed with the PTR_SIZE bytes before it
+ * as dictionary be appended bit after bit to the stream of those bytes
+ */
+int lz77_cctx_compress_bits (lz77_cctx_t *ctx, const uint8_t *src,
+    size_t len, uint8_t *dst, size_t dst_size, uint64_t *dst_bits, int level,
+    const uint8_t *dict, size_t dict_len);
+
+/* Streams compressing or decompressing one call at a time,
+ * into buffers owned by the caller
+ */
+typedef struct lz77_cstream lz77_cstream_t;
+typedef struct lz77_dstream lz77_dstream_t;
+
+lz77_cstream_t* lz77_cstream_new (int level);
+void lz77_cstream_destroy (lz77_cstream_t **stream_ptr);
+int lz77_cstream_set_dict (lz77_cstream_t *stream, const uint8_t *dict,
+    size_t dict_len);
+int lz77_cstream_update (lz77_cstream_t *stream, const uint8_t *src,
+    size_t src_len, size_t *src_used, uint8_t *dst, size_t dst_cap,
+    size_t *dst_used);
+int lz77_cstream_finish (lz77_cstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used);
+lz77_dstream_t* lz77_dstream_new ();
+void lz77_dstream_destroy (lz77_dstream_t **stream_ptr);
+int lz77_dstream_set_dict (lz77_dstream_t *stream, const uint8_t *dict,
+    size_t dict_len);
+int lz77_dstream_update (lz77_dstream_t *stream, const uint8_t *src,
+    size_t src_len, size_t *src_used, uint8_t *dst, size_t dst_cap,
+    size_t *dst_used);
+int lz77_dstream_finish (lz77_dstream_t *stream, uint8_t *dst,
+    size_t dst_cap, size_t *dst_used);
 
 #endif
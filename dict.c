@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compression.h"
+#include "dict.h"
+
+#define DICT_HASH_SIZE (1 << DICT_HASH_BITS)
+
+/* A segment of the samples picked by dict_train and its score
+ */
+typedef struct dict_segment {
+  size_t start;
+  uint64_t score;
+} dict_segment_t;
+
+/* Return the ID of a dictionary: the 32 bits FNV-1a hash of the bytes that
+ * can be pointed to, the last PTR_SIZE bytes of the len bytes at dict.
+ */
+uint32_t dict_id (const uint8_t *dict, size_t len) {
+  uint32_t hash;
+  size_t i;
+
+  if (len > PTR_SIZE) {
+    dict += len - PTR_SIZE;
+    len = PTR_SIZE;
+  }
+  hash = 2166136261u;
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ dict[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Write the DICT_HEADER_SIZE bytes of a dictionary header to header
+ */
+void dict_put_header (uint8_t *header, uint32_t id) {
+  memcpy (header, DICT_MAGIC, 4);
+  header[4] = id;
+  header[5] = id >> 8;
+  header[6] = id >> 16;
+  header[7] = id >> 24;
+}
+
+/* Return 1 if the len bytes at data start with a dictionary header,
+ * 0 otherwise
+ */
+int is_dict_header (const uint8_t *data, size_t len) {
+  return len >= DICT_HEADER_SIZE && memcmp (data, DICT_MAGIC, 4) == 0;
+}
+
+/* Return the dictionary ID of the dictionary header at the start of header
+ */
+uint32_t dict_header_id (const uint8_t *header) {
+  return header[4] | header[5] << 8 | header[6] << 16
+    | (uint32_t) header[7] << 24;
+}
+
+/* Check that the dict_len bytes of dict are the dictionary a dictionary
+ * header asks for, its ID being id.
+ * Return 0 for success and -1 for failure.
+ */
+int dict_check (uint32_t id, const uint8_t *dict, size_t dict_len) {
+  if (!dict_len) {
+    fprintf (stderr, "Compressed with dictionary %08x, give it with -D\n",
+        id);
+    return -1;
+  }
+  if (dict_id (dict, dict_len) != id) {
+    fprintf (stderr, "Compressed with dictionary %08x, not %08x\n", id,
+        dict_id (dict, dict_len));
+    return -1;
+  }
+  return 0;
+}
+
+/* Return the counter of the DICT_GRAM bytes substring at data
+ */
+static inline uint32_t gram_hash (const uint8_t *data) {
+  uint64_t value;
+  int i;
+
+  for (value = 0, i = 0; i < DICT_GRAM; i++) {
+    value = value << 8 | data[i];
+  }
+  return (value * 0x9E3779B97F4A7C15ull) >> (64 - DICT_HASH_BITS);
+}
+
+static int compare_segment (const void *a, const void *b) {
+  const dict_segment_t *x = a, *y = b;
+  return x->score < y->score ? -1 : x->score > y->score;
+}
+
+/* Build a dictionary of dict_size bytes at most, PTR_SIZE at most being
+ * useful, from count samples laid one after the other at samples, the
+ * length of each in sample_lens.
+ * Substrings of DICT_GRAM bytes are scored by the number of samples they
+ * appear in, those in a single sample scoring nothing. The samples are cut
+ * in as many epochs as the dictionary has segments of DICT_SEGMENT bytes,
+ * and the segment whose distinct substrings score most is picked from each
+ * epoch; the substrings it holds then score nothing so they are not picked
+ * again.
+ * Segments scoring most are put last, where they stay pointable longest.
+ * Return the size of the dictionary written to dict, 0 for failure.
+ */
+size_t dict_train (const uint8_t *samples, const size_t *sample_lens,
+    int count, uint8_t *dict, size_t dict_size) {
+  int i;
+  uint32_t *freq, *seen, h;
+  uint64_t score;
+  size_t total, start, pos, end, epoch, segments, seg_len, j, k;
+  dict_segment_t *picked;
+
+  for (total = 0, i = 0; i < count; i++) {
+    total += sample_lens[i];
+  }
+  if (dict_size > PTR_SIZE) dict_size = PTR_SIZE;
+  if (total <= dict_size) {
+    // Everything fits, the most recent samples last
+    memcpy (dict, samples, total);
+    return total;
+  }
+  seg_len = dict_size < DICT_SEGMENT ? dict_size : DICT_SEGMENT;
+  segments = dict_size / seg_len;
+  if (seg_len < DICT_GRAM) {
+    memcpy (dict, samples + total - dict_size, dict_size);
+    return dict_size;
+  }
+
+  freq = calloc (DICT_HASH_SIZE, sizeof (uint32_t));
+  seen = calloc (DICT_HASH_SIZE, sizeof (uint32_t));
+  picked = calloc (segments, sizeof (dict_segment_t));
+  if (!freq || !seen || !picked) {
+    free (freq);
+    free (seen);
+    free (picked);
+    return 0;
+  }
+
+  // Number of samples every substring appears in, seen holding the last
+  // sample counted plus 1
+  for (start = 0, i = 0; i < count; start += sample_lens[i], i++) {
+    for (pos = start; pos + DICT_GRAM <= start + sample_lens[i]; pos++) {
+      j = gram_hash (samples + pos);
+      if (seen[j] != (uint32_t) i + 1) {
+        seen[j] = i + 1;
+        freq[j]++;
+      }
+    }
+  }
+  for (j = 0; j < DICT_HASH_SIZE; j++) {
+    if (freq[j] < 2) freq[j] = 0;
+  }
+
+  // Best segment of every epoch over a sliding window, seen now counting
+  // the substrings in the window so repeated ones score once
+  memset (seen, 0, DICT_HASH_SIZE * sizeof (uint32_t));
+  epoch = total / segments;
+  for (k = 0; k < segments; k++) {
+    start = k * epoch;
+    end = start + epoch - seg_len;
+    score = 0;
+    for (j = 0; j + DICT_GRAM <= seg_len; j++) {
+      h = gram_hash (samples + start + j);
+      if (seen[h]++ == 0) score += freq[h];
+    }
+    picked[k].start = start;
+    picked[k].score = score;
+    for (pos = start + 1; pos <= end + seg_len - DICT_GRAM + 1; pos++) {
+      h = gram_hash (samples + pos - 1);
+      if (--seen[h] == 0) score -= freq[h];
+      if (pos > end) continue;
+      h = gram_hash (samples + pos + seg_len - DICT_GRAM);
+      if (seen[h]++ == 0) score += freq[h];
+      if (score > picked[k].score) {
+        picked[k].start = pos;
+        picked[k].score = score;
+      }
+    }
+    for (j = 0; j + DICT_GRAM <= seg_len; j++) {
+      freq[gram_hash (samples + picked[k].start + j)] = 0;
+    }
+  }
+
+  qsort (picked, segments, sizeof (dict_segment_t), compare_segment);
+  for (k = 0; k < segments; k++) {
+    memcpy (dict + k * seg_len, samples + picked[k].start, seg_len);
+  }
+
+  free (freq);
+  free (seen);
+  free (picked);
+  return segments * seg_len;
+}
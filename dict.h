@@ -0,0 +1,26 @@
+#ifndef DICT_H
+#define DICT_H
+
+/* Dictionary header, optional in front of a headerless stream compressed
+ * with a preset dictionary: the 4 bytes DICT_MAGIC then the ID of the
+ * dictionary in 4 bytes, little endian. Like FRAME_MAGIC its first byte has
+ * its MSB set, which the first byte of a headerless stream never has.
+ */
+#define DICT_MAGIC "\x8ALZD"
+#define DICT_HEADER_SIZE 8
+
+// Bytes of the substrings counted by dict_train and of the segments it
+// picks, and log2 of the number of substring counters
+#define DICT_GRAM 6
+#define DICT_SEGMENT 64
+#define DICT_HASH_BITS 20
+
+uint32_t dict_id (const uint8_t *dict, size_t len);
+void dict_put_header (uint8_t *header, uint32_t id);
+int is_dict_header (const uint8_t *data, size_t len);
+uint32_t dict_header_id (const uint8_t *header);
+int dict_check (uint32_t id, const uint8_t *dict, size_t dict_len);
+size_t dict_train (const uint8_t *samples, const size_t *sample_lens,
+    int count, uint8_t *dict, size_t dict_size);
+
+#endif
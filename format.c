@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "compression.h"
+#include "format.h"
+
+/* Write the FORMAT_HEADER_SIZE bytes of the format header of the preset
+ * built in to header
+ */
+void format_put_header (uint8_t *header) {
+  memcpy (header, FORMAT_MAGIC, 4);
+  header[4] = LZ77_FORMAT;
+  header[5] = 0;
+  header[6] = 0;
+  header[7] = 0;
+}
+
+/* Return 1 if the len bytes at data start with a format header,
+ * 0 otherwise
+ */
+int is_format_header (const uint8_t *data, size_t len) {
+  return len >= FORMAT_HEADER_SIZE && memcmp (data, FORMAT_MAGIC, 4) == 0;
+}
+
+/* Check that data of the format preset can be decompressed, only the
+ * preset built in can.
+ * Return 0 for success and -1 for failure.
+ */
+int format_check (int preset) {
+  if (preset != LZ77_FORMAT) {
+    fprintf (stderr, "Compressed with format preset %d, built for %d: "
+        "build with make FORMAT=%d\n", preset, LZ77_FORMAT, preset);
+    return -1;
+  }
+  return 0;
+}
+
+/* Check the format of the len bytes at data, which start with a format
+ * header unless of the legacy preset.
+ * Return the size of the header to skip, 0 if none,
+ * or (size_t) -1 if the preset is not the one built in.
+ */
+size_t format_skip_header (const uint8_t *data, size_t len) {
+  if (!is_format_header (data, len)) {
+    return format_check (0) == 0 ? 0 : (size_t) -1;
+  }
+  return format_check (data[4]) == 0 ? FORMAT_HEADER_SIZE : (size_t) -1;
+}
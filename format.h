@@ -0,0 +1,20 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+/* Format header, in front of a headerless stream, or of its dictionary
+ * header, written with a format preset other than the legacy one: the
+ * 4 bytes FORMAT_MAGIC, the preset ID in a byte and 3 reserved bytes, 0.
+ * Like FRAME_MAGIC its first byte has its MSB set. A stream without it is
+ * of the legacy preset. Frames record the preset in their own header.
+ */
+#define FORMAT_MAGIC "\x8BLZF"
+#define FORMAT_HEADER_SIZE 8
+// Bytes of format header written by this build
+#define FORMAT_HEADER_LEN (LZ77_FORMAT ? FORMAT_HEADER_SIZE : 0)
+
+void format_put_header (uint8_t *header);
+int is_format_header (const uint8_t *data, size_t len);
+int format_check (int preset);
+size_t format_skip_header (const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,681 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "compression.h"
+#include "format.h"
+#include "frame.h"
+#include "pool.h"
+#include "progress.h"
+#include "stats.h"
+
+/* State shared by the blocks of one headerless stream compressed in
+ * parallel: the last PTR_SIZE bytes read at most, the window the next block
+ * is compressed from, and the last bits written, fewer than a byte, at the
+ * MSB of byte, which the bits of the next block follow.
+ */
+typedef struct frame_splice {
+  uint8_t history[PTR_SIZE];
+  size_t history_len;
+  uint8_t byte;
+  int bit_count;
+} frame_splice_t;
+
+/* A block of a frame, compressed or decompressed by a worker:
+ * in_len bytes of in are turned into out_len bytes of out.
+ */
+typedef struct frame_block {
+  pool_job_t job;
+  uint8_t *in;
+  size_t in_size;
+  size_t in_len;
+  uint8_t *out;
+  size_t out_size;
+  size_t out_len;
+  int level;
+  // Tables kept from block to block when compressing, NULL otherwise
+  lz77_cctx_t *ctx;
+  // When splicing, the block follows the primed bytes of in it is
+  // compressed from, and out holds out_bits bits
+  frame_splice_t *splice;
+  size_t primed;
+  uint64_t out_bits;
+  // Set if in is stored as it is rather than compressed
+  int stored;
+  int result;
+} frame_block_t;
+
+/* Read the next block of a pipeline from in.
+ * Return 1 if a block was read, 0 at the end of in and -1 for failure.
+ */
+typedef int (*read_block_fn) (FILE *in, frame_block_t *block);
+
+/* Write a block of a pipeline once run to out.
+ * Return 0 for success and -1 for failure.
+ */
+typedef int (*write_block_fn) (FILE *out, frame_block_t *block);
+
+/* The position of a block in a framed buffer
+ */
+typedef struct frame_entry {
+  pool_job_t job;
+  const uint8_t *in;
+  uint32_t in_len;
+  uint8_t *out;
+  uint32_t out_len;
+  int stored;
+  int result;
+} frame_entry_t;
+
+static void put_le32 (uint8_t *dst, uint32_t value) {
+  dst[0] = value;
+  dst[1] = value >> 8;
+  dst[2] = value >> 16;
+  dst[3] = value >> 24;
+}
+
+static uint32_t get_le32 (const uint8_t *src) {
+  return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t) src[3] << 24;
+}
+
+/* Return 1 if the len bytes at data start with a frame header, 0 otherwise
+ */
+int is_framed (const uint8_t *data, size_t len) {
+  return len >= 4 && memcmp (data, FRAME_MAGIC, 4) == 0;
+}
+
+/* Check the frame header at the start of header,
+ * the block size is put in block_size.
+ * Return 0 for success and -1 for failure.
+ */
+static int check_frame_header (const uint8_t *header, uint32_t *block_size) {
+  if (!is_framed (header, FRAME_HEADER_SIZE) || header[4] != FRAME_VERSION) {
+    fprintf (stderr, "Not a framed file\n");
+    return -1;
+  }
+  if (format_check (header[6]) != 0) {
+    return -1;
+  }
+  *block_size = get_le32 (header + 8);
+  if (!*block_size || *block_size > FRAME_MAX_BLOCK_SIZE) {
+    fprintf (stderr, "Invalid block size %u\n", *block_size);
+    return -1;
+  }
+  return 0;
+}
+
+/* Check the sizes of a block header against the block size of its frame,
+ * stored being set for a stored block.
+ * Return 1 for a block, 0 for the end of the frame and -1 for failure.
+ */
+static int check_block_header (const uint8_t *header, uint32_t block_size,
+    uint32_t *in_len, uint32_t *out_len, int *stored) {
+  *in_len = get_le32 (header);
+  *out_len = get_le32 (header + 4);
+  *stored = (*in_len & FRAME_STORED) != 0;
+  *in_len &= ~FRAME_STORED;
+  if (!*in_len && !*out_len && !*stored) {
+    return 0;
+  }
+  if ((*stored ? *in_len != *out_len : *in_len > compress_bound (block_size))
+      || *out_len > block_size) {
+    fprintf (stderr, "Invalid block\n");
+    return -1;
+  }
+  return 1;
+}
+
+/* Run blocks read from in by workers of pool and write them to out in the
+ * order they were read, with up to slots blocks in flight.
+ * Progress is reported in bytes of in, out of its size if a regular file.
+ * Return 0 for success and -1 for failure.
+ */
+static int run_blocks (FILE *in, FILE *out, pool_t *pool,
+    frame_block_t *blocks, int slots,
+    read_block_fn read_block, write_block_fn write_block) {
+  int eof, result;
+  uint64_t read, written, done, total;
+  struct stat st;
+  frame_block_t *block;
+
+  total = 0;
+  if (fstat (fileno (in), &st) == 0 && S_ISREG (st.st_mode)) {
+    total = st.st_size;
+  }
+  done = 0;
+  read = 0;
+  written = 0;
+  eof = 0;
+  result = 0;
+  while (1) {
+    // Keep every slot busy while there are blocks left
+    while (!eof && read - written < slots) {
+      block = blocks + read % slots;
+      eof = read_block (in, block);
+      if (eof < 0) {
+        result = -1;
+      }
+      eof = (eof != 1);
+      if (eof) break;
+      pool_submit (pool, &block->job);
+      read += 1;
+    }
+    if (written == read) break;
+
+    // Write the oldest block once run
+    block = blocks + written % slots;
+    pool_wait (pool, &block->job);
+    if (result == 0 && (block->result != 0
+          || write_block (out, block) != 0)) {
+      result = -1;
+      eof = 1;
+    }
+    written += 1;
+    done += block->in_len;
+    progress_report (done, total, 0);
+  }
+  progress_report (done, total, 1);
+  return result;
+}
+
+/* Allocate slots blocks with in_size bytes of input and out_size bytes of
+ * output each, run by run. Return NULL for failure.
+ */
+static frame_block_t* blocks_new (int slots, size_t in_size, size_t out_size,
+    void (*run) (pool_job_t *job)) {
+  int i;
+  frame_block_t *blocks;
+
+  blocks = calloc (slots, sizeof (frame_block_t));
+  for (i = 0; blocks && i < slots; i++) {
+    blocks[i].job.run = run;
+    blocks[i].in_size = in_size;
+    blocks[i].in = malloc (in_size);
+    blocks[i].out_size = out_size;
+    blocks[i].out = malloc (out_size);
+    if (!blocks[i].in || !blocks[i].out) {
+      for (; i >= 0; i--) {
+        free (blocks[i].in);
+        free (blocks[i].out);
+      }
+      free (blocks);
+      return NULL;
+    }
+  }
+  return blocks;
+}
+
+static void blocks_destroy (frame_block_t *blocks, int slots) {
+  int i;
+  for (i = 0; i < slots; i++) {
+    if (blocks[i].ctx) lz77_cctx_destroy (&blocks[i].ctx);
+    free (blocks[i].in);
+    free (blocks[i].out);
+  }
+  free (blocks);
+}
+
+/* Return 1 if the len bytes at in hold too few patterns for compressing
+ * them to pay off, 0 otherwise: FRAME_SAMPLES spans spread over in are
+ * compressed by ctx at the fastest level to dst, which can hold dst_size
+ * bytes, and must not shrink. Inputs too short to sample return 0.
+ */
+static int is_incompressible (lz77_cctx_t *ctx, const uint8_t *in,
+    size_t len, uint8_t *dst, size_t dst_size) {
+  size_t span, total, n;
+  int i, result;
+  STATS_SAVED (saved);
+
+  // A span holds 2 windows at least, so patterns as far back as a window
+  // can be found in its second half
+  span = FRAME_SAMPLE_SIZE > 2 * PTR_SIZE ? FRAME_SAMPLE_SIZE : 2 * PTR_SIZE;
+  if (len < FRAME_SAMPLES * span * 2) {
+    return 0;
+  }
+  // The samples are not part of the output, nor of the counters
+  STATS_PAUSE (saved);
+  result = 1;
+  for (total = 0, i = 0; result && i < FRAME_SAMPLES; i++) {
+    if (lz77_cctx_compress (ctx, in + (len - span) * i / (FRAME_SAMPLES - 1),
+          span, dst, dst_size, &n, COMPRESS_MIN_LEVEL, NULL, 0) != 0) {
+      result = 0;
+    } else {
+      total += n;
+    }
+  }
+  STATS_RESUME (saved);
+  return result && total >= FRAME_SAMPLES * span;
+}
+
+/* Compress a block, or store it if sampling finds it incompressible or it
+ * does not shrink
+ */
+static void compress_block (pool_job_t *job) {
+  frame_block_t *block = (frame_block_t*) job;
+  uint8_t *dst = block->out + FRAME_BLOCK_HEADER_SIZE;
+  size_t dst_size = block->out_size - FRAME_BLOCK_HEADER_SIZE;
+
+  block->stored = is_incompressible (block->ctx, block->in, block->in_len,
+      dst, dst_size);
+  if (block->stored) {
+    STATS_ADD (bytes_in, block->in_len);
+    STATS_ADD (bytes_out, block->in_len);
+  } else {
+    block->result = lz77_cctx_compress (block->ctx, block->in, block->in_len,
+        dst, dst_size, &block->out_len, block->level, NULL, 0);
+    block->stored = block->result == 0 && block->out_len >= block->in_len;
+    // The compressed bytes counted give way to the stored ones, no fewer,
+    // the difference wrapping around as the counters are unsigned
+    if (block->stored) {
+      STATS_ADD (bytes_out, block->in_len - block->out_len);
+    }
+  }
+  if (block->stored) {
+    memcpy (dst, block->in, block->in_len);
+    block->out_len = block->in_len;
+    block->result = 0;
+    STATS_FOLD ();
+  }
+}
+
+static int read_raw_block (FILE *in, frame_block_t *block) {
+  block->in_len = fread (block->in, 1, block->in_size, in);
+  if (block->in_len == 0) {
+    return ferror (in) ? -1 : 0;
+  }
+  return 1;
+}
+
+static int write_compressed_block (FILE *out, frame_block_t *block) {
+  size_t len = FRAME_BLOCK_HEADER_SIZE + block->out_len;
+  put_le32 (block->out, block->out_len | (block->stored ? FRAME_STORED : 0));
+  put_le32 (block->out + 4, block->in_len);
+  return fwrite (block->out, 1, len, out) == len ? 0 : -1;
+}
+
+/* Compress in to out in the framed format, splitting in into blocks of
+ * block_size bytes compressed at level by threads workers.
+ * Blocks are written in order as soon as they are compressed,
+ * with up to 2 blocks per worker in flight.
+ * Both files are closed. Return 0 for success and -1 for failure.
+ */
+int compress_framed (FILE *in, FILE *out, int threads, uint32_t block_size,
+    int level) {
+  int i, slots, result;
+  uint8_t header[FRAME_HEADER_SIZE];
+  frame_block_t *blocks;
+  pool_t *pool;
+
+  slots = threads * 2;
+  blocks = blocks_new (slots, block_size,
+      FRAME_BLOCK_HEADER_SIZE + compress_bound (block_size), compress_block);
+  pool = pool_new (threads);
+  result = (blocks && pool) ? 0 : -1;
+  // Every slot keeps its tables, as a slot is run by one worker at a time
+  for (i = 0; blocks && i < slots; i++) {
+    blocks[i].level = level;
+    blocks[i].ctx = lz77_cctx_new ();
+    if (!blocks[i].ctx) result = -1;
+  }
+  if (result != 0) {
+    perror ("compress_framed");
+  }
+
+  memcpy (header, FRAME_MAGIC, 4);
+  header[4] = FRAME_VERSION;
+  header[5] = 0;
+  header[6] = LZ77_FORMAT;
+  header[7] = 0;
+  put_le32 (header + 8, block_size);
+  if (result == 0 && fwrite (header, 1, FRAME_HEADER_SIZE, out)
+      != FRAME_HEADER_SIZE) {
+    result = -1;
+  }
+
+  if (result == 0) {
+    fprintf (stderr, "Compressing...\n");
+    result = run_blocks (in, out, pool, blocks, slots,
+        read_raw_block, write_compressed_block);
+  }
+
+  // End of frame
+  memset (header, 0, FRAME_BLOCK_HEADER_SIZE);
+  if (result == 0 && fwrite (header, 1, FRAME_BLOCK_HEADER_SIZE, out)
+      != FRAME_BLOCK_HEADER_SIZE) {
+    result = -1;
+  }
+  if (fclose (out) != 0) {
+    result = -1;
+  }
+  fclose (in);
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+
+  if (pool) pool_destroy (&pool);
+  if (blocks) blocks_destroy (blocks, slots);
+  return result;
+}
+
+static void compress_spliced_block (pool_job_t *job) {
+  frame_block_t *block = (frame_block_t*) job;
+  // A byte of out is left for write_spliced_block to shift bits into
+  block->result = lz77_cctx_compress_bits (block->ctx,
+      block->in + block->primed, block->in_len, block->out,
+      block->out_size - 1, &block->out_bits, block->level,
+      block->in, block->primed);
+}
+
+/* Read a block after a copy of the PTR_SIZE bytes read before it at most,
+ * which it is compressed from
+ */
+static int read_primed_block (FILE *in, frame_block_t *block) {
+  frame_splice_t *splice = block->splice;
+  size_t len, keep;
+
+  memcpy (block->in, splice->history, splice->history_len);
+  block->primed = splice->history_len;
+  block->in_len = fread (block->in + block->primed, 1,
+      block->in_size - PTR_SIZE, in);
+  if (block->in_len == 0) {
+    return ferror (in) ? -1 : 0;
+  }
+  len = block->primed + block->in_len;
+  keep = len < PTR_SIZE ? len : PTR_SIZE;
+  memcpy (splice->history, block->in + len - keep, keep);
+  splice->history_len = keep;
+  return 1;
+}
+
+/* Write the bits of a block right after those of the blocks before it,
+ * keeping the bits past its last whole byte for the next block
+ */
+static int write_spliced_block (FILE *out, frame_block_t *block) {
+  frame_splice_t *splice = block->splice;
+  uint8_t *bytes = block->out;
+  uint8_t byte, next;
+  uint64_t bits;
+  size_t i, len, whole;
+  int shift = splice->bit_count;
+
+  // Shift the bytes right by the bits pending, in place, the bits shifted
+  // out of the last byte going to the byte after it
+  len = (block->out_bits + 7) / 8;
+  if (shift) {
+    byte = splice->byte;
+    for (i = 0; i < len; i++) {
+      next = bytes[i] << (8 - shift);
+      bytes[i] = byte | bytes[i] >> shift;
+      byte = next;
+    }
+    bytes[len] = byte;
+  }
+  bits = shift + block->out_bits;
+  whole = bits / 8;
+  splice->bit_count = bits % 8;
+  splice->byte = splice->bit_count ? bytes[whole] : 0;
+  return fwrite (bytes, 1, whole, out) == whole ? 0 : -1;
+}
+
+/* Compress in to out as compress_file_dict does, to one headerless stream
+ * any decompressor of the format reads, on threads workers: in is split
+ * into blocks of block_size bytes, each compressed from a window primed
+ * with the PTR_SIZE bytes before it, or with dict for the first one, and
+ * the bits of every block are written right after those of the block
+ * before it. Only the last byte is padded.
+ * Both files are closed. Return 0 for success and -1 for failure.
+ */
+int compress_spliced (FILE *in, FILE *out, int threads, uint32_t block_size,
+    int level, const uint8_t *dict, size_t dict_len) {
+  int i, slots, result;
+  frame_splice_t *splice;
+  frame_block_t *blocks;
+  pool_t *pool;
+
+  slots = threads * 2;
+  splice = calloc (1, sizeof (frame_splice_t));
+  blocks = blocks_new (slots, PTR_SIZE + block_size,
+      compress_bound (block_size) + 1, compress_spliced_block);
+  pool = pool_new (threads);
+  result = (splice && blocks && pool) ? 0 : -1;
+  for (i = 0; blocks && i < slots; i++) {
+    blocks[i].level = level;
+    blocks[i].splice = splice;
+    blocks[i].ctx = lz77_cctx_new ();
+    if (!blocks[i].ctx) result = -1;
+  }
+  if (result != 0) {
+    perror ("compress_spliced");
+  }
+
+  if (result == 0 && dict_len) {
+    if (dict_len > PTR_SIZE) {
+      dict += dict_len - PTR_SIZE;
+      dict_len = PTR_SIZE;
+    }
+    memcpy (splice->history, dict, dict_len);
+    splice->history_len = dict_len;
+  }
+  if (result == 0) {
+    fprintf (stderr, "Compressing...\n");
+    result = run_blocks (in, out, pool, blocks, slots,
+        read_primed_block, write_spliced_block);
+  }
+
+  // The bits of the last byte, padded with 0s
+  if (result == 0 && splice->bit_count && fputc (splice->byte, out) == EOF) {
+    result = -1;
+  }
+  if (fclose (out) != 0) {
+    result = -1;
+  }
+  fclose (in);
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+
+  if (pool) pool_destroy (&pool);
+  if (blocks) blocks_destroy (blocks, slots);
+  free (splice);
+  return result;
+}
+
+static void decompress_block (pool_job_t *job) {
+  size_t expected;
+  frame_block_t *block = (frame_block_t*) job;
+
+  if (block->stored) {
+    memcpy (block->out, block->in, block->in_len);
+    block->result = 0;
+    return;
+  }
+  expected = block->out_len;
+  block->result = decompress_buffer (block->in, block->in_len,
+      block->out, expected, &block->out_len);
+  if (block->result == 0 && block->out_len != expected) {
+    fprintf (stderr, "Invalid block\n");
+    block->result = -1;
+  }
+}
+
+/* Read a block header and its compressed bytes, the size it decompresses
+ * to is put in out_len. The block size of the frame is out_size.
+ */
+static int read_compressed_block (FILE *in, frame_block_t *block) {
+  int result, stored;
+  uint32_t in_len, out_len;
+
+  if (fread (block->in, 1, FRAME_BLOCK_HEADER_SIZE, in)
+      != FRAME_BLOCK_HEADER_SIZE) {
+    fprintf (stderr, "Truncated file\n");
+    return -1;
+  }
+  result = check_block_header (block->in, block->out_size, &in_len, &out_len,
+      &stored);
+  if (result != 1) {
+    return result;
+  }
+  if (fread (block->in, 1, in_len, in) != in_len) {
+    fprintf (stderr, "Truncated file\n");
+    return -1;
+  }
+  block->in_len = in_len;
+  block->out_len = out_len;
+  block->stored = stored;
+  return 1;
+}
+
+static int write_raw_block (FILE *out, frame_block_t *block) {
+  return fwrite (block->out, 1, block->out_len, out) == block->out_len
+    ? 0 : -1;
+}
+
+/* Decompress a framed in to out, blocks are decompressed by threads
+ * workers and written in order.
+ * Both files are closed. Return 0 for success and -1 for failure.
+ */
+int decompress_framed (FILE *in, FILE *out, int threads) {
+  int slots, result;
+  uint8_t header[FRAME_HEADER_SIZE];
+  uint32_t block_size;
+  frame_block_t *blocks;
+  pool_t *pool;
+
+  blocks = NULL;
+  pool = NULL;
+  slots = threads * 2;
+  result = -1;
+  if (fread (header, 1, FRAME_HEADER_SIZE, in) == FRAME_HEADER_SIZE) {
+    result = check_frame_header (header, &block_size);
+  }
+  if (result == 0) {
+    blocks = blocks_new (slots, compress_bound (block_size), block_size,
+        decompress_block);
+    pool = pool_new (threads);
+    if (!blocks || !pool) {
+      perror ("decompress_framed");
+      result = -1;
+    }
+  }
+
+  if (result == 0) {
+    fprintf (stderr, "Decompressing...\n");
+    result = run_blocks (in, out, pool, blocks, slots,
+        read_compressed_block, write_raw_block);
+    fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+  }
+
+  if (fclose (out) != 0) {
+    result = -1;
+  }
+  fclose (in);
+  if (pool) pool_destroy (&pool);
+  if (blocks) blocks_destroy (blocks, slots);
+  return result;
+}
+
+/* Walk the block headers of the framed len bytes at src, the total size
+ * of the blocks decompressed is put in size.
+ * Return the number of blocks, or -1 if src is not a valid frame.
+ */
+long framed_size (const uint8_t *src, size_t len, uint64_t *size) {
+  int result, stored;
+  uint32_t block_size, in_len, out_len;
+  size_t pos;
+  long count;
+
+  if (len < FRAME_HEADER_SIZE
+      || check_frame_header (src, &block_size) != 0) {
+    return -1;
+  }
+  *size = 0;
+  count = 0;
+  for (pos = FRAME_HEADER_SIZE; ; pos += in_len) {
+    if (len - pos < FRAME_BLOCK_HEADER_SIZE) {
+      fprintf (stderr, "Truncated file\n");
+      return -1;
+    }
+    result = check_block_header (src + pos, block_size, &in_len, &out_len,
+        &stored);
+    if (result <= 0) {
+      return result == 0 ? count : -1;
+    }
+    pos += FRAME_BLOCK_HEADER_SIZE;
+    if (len - pos < in_len) {
+      fprintf (stderr, "Truncated file\n");
+      return -1;
+    }
+    *size += out_len;
+    count += 1;
+  }
+}
+
+static void decompress_entry (pool_job_t *job) {
+  size_t len;
+  frame_entry_t *entry = (frame_entry_t*) job;
+
+  if (entry->stored) {
+    memcpy (entry->out, entry->in, entry->in_len);
+    entry->result = 0;
+    return;
+  }
+  entry->result = decompress_buffer (entry->in, entry->in_len,
+      entry->out, entry->out_len, &len);
+  if (entry->result == 0 && len != entry->out_len) {
+    entry->result = -1;
+  }
+}
+
+/* Decompress the framed len bytes at src to dst, which must hold the size
+ * given by framed_size. Every block is decompressed by one of threads
+ * workers straight to its place in dst.
+ * Return 0 for success and -1 for failure.
+ */
+int decompress_framed_buffer (const uint8_t *src, size_t len, uint8_t *dst,
+    int threads) {
+  int result;
+  uint32_t block_size;
+  uint64_t size;
+  size_t pos;
+  long count, i;
+  frame_entry_t *entries;
+  pool_t *pool;
+
+  count = framed_size (src, len, &size);
+  if (count < 0) {
+    return -1;
+  }
+  entries = malloc (sizeof (frame_entry_t) * (count ? count : 1));
+  pool = pool_new (threads);
+  if (!entries || !pool) {
+    free (entries);
+    if (pool) pool_destroy (&pool);
+    return -1;
+  }
+
+  // The headers were checked by framed_size
+  check_frame_header (src, &block_size);
+  pos = FRAME_HEADER_SIZE;
+  for (i = 0; i < count; i++) {
+    entries[i].job.run = decompress_entry;
+    entries[i].in_len = get_le32 (src + pos) & ~FRAME_STORED;
+    entries[i].out_len = get_le32 (src + pos + 4);
+    entries[i].stored = (get_le32 (src + pos) & FRAME_STORED) != 0;
+    entries[i].in = src + pos + FRAME_BLOCK_HEADER_SIZE;
+    entries[i].out = dst;
+    pos += FRAME_BLOCK_HEADER_SIZE + entries[i].in_len;
+    dst += entries[i].out_len;
+    pool_submit (pool, &entries[i].job);
+  }
+
+  result = 0;
+  for (i = 0; i < count; i++) {
+    pool_wait (pool, &entries[i].job);
+    if (entries[i].result != 0) {
+      fprintf (stderr, "Invalid block %ld\n", i);
+      result = -1;
+    }
+  }
+
+  pool_destroy (&pool);
+  free (entries);
+  return result;
+}
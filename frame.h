@@ -0,0 +1,43 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+/* Framed format:
+ * A header of FRAME_HEADER_SIZE bytes: the 4 bytes FRAME_MAGIC, a version
+ * byte, a flags byte, the format preset byte (see compression.h), a reserved
+ * byte and the block size in 4 bytes.
+ * Then blocks, each compressed independently of the others: a header of
+ * FRAME_BLOCK_HEADER_SIZE bytes, its compressed and uncompressed sizes
+ * in 4 bytes each, followed by the compressed bytes.
+ * A block whose compressed size has FRAME_STORED set is stored: the size
+ * without it is the uncompressed size and the block its bytes as they are.
+ * A block header with both sizes 0 ends the frame.
+ * Numbers are little endian.
+ *
+ * A headerless stream always starts with a <0,VALUE>, so its first bit is
+ * a 0, while the first byte of FRAME_MAGIC has its MSB set.
+ */
+#define FRAME_MAGIC "\x89LZ7"
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 12
+#define FRAME_BLOCK_HEADER_SIZE 8
+#define FRAME_BLOCK_SIZE 0x100000
+#define FRAME_MAX_BLOCK_SIZE 0x40000000
+#define FRAME_STORED 0x80000000
+// Blocks are sampled before being compressed: FRAME_SAMPLES spans of
+// FRAME_SAMPLE_SIZE bytes, or 2 windows if larger, compressed at the fastest
+// level to no less than their size have the block stored without searching
+#define FRAME_SAMPLES 4
+#define FRAME_SAMPLE_SIZE 0x4000
+
+int is_framed (const uint8_t *data, size_t len);
+int compress_framed (FILE *in, FILE *out, int threads, uint32_t block_size,
+    int level);
+int decompress_framed (FILE *in, FILE *out, int threads);
+// Not framed, one headerless stream compressed by several workers
+int compress_spliced (FILE *in, FILE *out, int threads, uint32_t block_size,
+    int level, const uint8_t *dict, size_t dict_len);
+long framed_size (const uint8_t *src, size_t len, uint64_t *size);
+int decompress_framed_buffer (const uint8_t *src, size_t len, uint8_t *dst,
+    int threads);
+
+#endif
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped.h"
+
+/* Map a regular file for reading, its pages are read ahead.
+ * Return NULL if the file cannot be opened or is not a regular file,
+ * in which case the caller should read it with stdio instead.
+ */
+mapped_file_t* mapped_file_open (const char *filename) {
+  struct stat file_stat;
+  mapped_file_t *file;
+  int fd;
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat (fd, &file_stat) != 0 || !S_ISREG (file_stat.st_mode)) {
+    close (fd);
+    return NULL;
+  }
+
+  file = malloc (sizeof (mapped_file_t));
+  if (!file) {
+    close (fd);
+    return NULL;
+  }
+  file->fd = fd;
+  file->size = file_stat.st_size;
+  file->data = NULL;
+  if (file->size) {
+    file->data = mmap (NULL, file->size, PROT_READ,
+        MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (file->data == MAP_FAILED) {
+      close (fd);
+      free (file);
+      return NULL;
+    }
+    madvise (file->data, file->size, MADV_SEQUENTIAL);
+  }
+  return file;
+}
+
+/* Return 1 if filename can be created and mapped for writing: it does not
+ * exist yet or is a regular file. Devices such as /dev/null, pipes and
+ * FIFOs return 0, in which case the caller should write with stdio instead.
+ */
+int mapped_file_can_create (const char *filename) {
+  struct stat file_stat;
+
+  if (stat (filename, &file_stat) != 0) {
+    return errno == ENOENT;
+  }
+  return S_ISREG (file_stat.st_mode);
+}
+
+/* Create a file of size bytes and map it for writing.
+ * If allocate is set the disk blocks are reserved up front, so running out
+ * of space is reported here instead of faulting while writing the map.
+ * Return NULL for failure, with errno set.
+ */
+mapped_file_t* mapped_file_create (const char *filename, size_t size,
+    int allocate) {
+  mapped_file_t *file;
+  int fd, error;
+
+  fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return NULL;
+  }
+  // posix_fallocate returns its error rather than setting errno
+  error = allocate && size ? posix_fallocate (fd, 0, size)
+    : ftruncate (fd, size) != 0 ? errno : 0;
+  if (error != 0) {
+    close (fd);
+    errno = error;
+    return NULL;
+  }
+
+  file = malloc (sizeof (mapped_file_t));
+  if (!file) {
+    close (fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  file->fd = fd;
+  file->size = size;
+  file->data = NULL;
+  if (file->size) {
+    file->data = mmap (NULL, file->size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (file->data == MAP_FAILED) {
+      error = errno;
+      close (fd);
+      free (file);
+      errno = error;
+      return NULL;
+    }
+    madvise (file->data, file->size, MADV_SEQUENTIAL);
+  }
+  return file;
+}
+
+/* Unmap and close a file. If it was created for writing,
+ * it is truncated to the size bytes actually written.
+ * Return 0 for success and -1 for failure.
+ */
+int mapped_file_close (mapped_file_t **file_ptr, size_t size) {
+  int result = 0;
+  mapped_file_t *file = *file_ptr;
+
+  if (file->data) {
+    munmap (file->data, file->size);
+  }
+  if (size < file->size && ftruncate (file->fd, size) != 0) {
+    result = -1;
+  }
+  if (close (file->fd) != 0) {
+    result = -1;
+  }
+  free (file);
+  *file_ptr = NULL;
+  return result;
+}
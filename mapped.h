@@ -0,0 +1,19 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+/* A file mapped in memory:
+ * data points to size bytes of the file, or is NULL when size is 0.
+ */
+typedef struct mapped_file {
+  uint8_t *data;
+  size_t size;
+  int fd;
+} mapped_file_t;
+
+mapped_file_t* mapped_file_open (const char *filename);
+int mapped_file_can_create (const char *filename);
+mapped_file_t* mapped_file_create (const char *filename, size_t size,
+    int allocate);
+int mapped_file_close (mapped_file_t **file_ptr, size_t size);
+
+#endif
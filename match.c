@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "match.h"
+#include "stats.h"
+
+#define PREFIX(buf, pos) (((uint32_t) (buf)[pos] << 8) | (buf)[(pos) + 1])
+
+/* Create a match finder for a window of window bytes (a power of 2),
+ * following at most max_chain links per lookup and settling for the first
+ * pattern of at least good_len bytes.
+ */
+match_finder_t* match_finder_new (uint32_t window, int max_chain,
+    int good_len) {
+  match_finder_t *finder;
+
+  finder = malloc (sizeof (match_finder_t));
+  if (finder) {
+    finder->head = calloc (MATCH_HEAD_SIZE, sizeof (uint32_t));
+    finder->prev = calloc (window, sizeof (uint32_t));
+    if (!finder->head || !finder->prev) {
+      free (finder->head);
+      free (finder->prev);
+      free (finder);
+      return NULL;
+    }
+    finder->base = 0;
+    finder->window = window;
+    finder->max_chain = max_chain;
+    finder->good_len = good_len;
+  }
+  return finder;
+}
+
+void match_finder_destroy (match_finder_t **finder_ptr) {
+  match_finder_t *finder = *finder_ptr;
+  free (finder->head);
+  free (finder->prev);
+  free (finder);
+  *finder_ptr = NULL;
+}
+
+/* Link the 2 bytes pattern starting at buf[pos] into its chain.
+ * buf[pos + 1] must be readable.
+ */
+void match_finder_insert (match_finder_t *finder, const uint8_t *buf,
+    uint32_t pos) {
+  uint32_t *head = finder->head + PREFIX (buf, pos);
+  finder->prev[pos & (finder->window - 1)] = *head;
+  *head = finder->base + pos + 1;
+  STATS_ADD (inserts, 1);
+}
+
+/* Return the number of leading bytes a and b have in common, up to max_len.
+ * avail bytes can be read from a, and b is before a in the same buffer.
+ * Bytes are compared 16 at a time while avail allows it: one SSE2 compare
+ * and the first difference found from its mask, or 2 words compared with
+ * XOR without SSE2.
+ */
+static inline int match_length (const uint8_t *a, const uint8_t *b,
+    int max_len, uint32_t avail) {
+  int len;
+#ifdef __SSE2__
+  __m128i x, y;
+  uint32_t mask;
+#else
+  uint64_t x, y;
+#endif
+
+  for (len = 0; len < max_len && len + 16 <= avail; len += 16) {
+#ifdef __SSE2__
+    x = _mm_loadu_si128 ((const __m128i*) (a + len));
+    y = _mm_loadu_si128 ((const __m128i*) (b + len));
+    mask = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (x, y)) & 0xFFFF;
+    if (mask) {
+      len += __builtin_ctz (mask);
+      return len < max_len ? len : max_len;
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy (&x, a + len, 8);
+    memcpy (&y, b + len, 8);
+    if (x != y) {
+      len += __builtin_ctzll (x ^ y) >> 3;
+      return len < max_len ? len : max_len;
+    }
+    memcpy (&x, a + len + 8, 8);
+    memcpy (&y, b + len + 8, 8);
+    if (x != y) {
+      len += 8 + (__builtin_ctzll (x ^ y) >> 3);
+      return len < max_len ? len : max_len;
+    }
+#else
+    if (memcmp (a + len, b + len, 16) != 0) break;
+#endif
+  }
+
+  // Near the end of the readable bytes
+  for (; len < max_len && a[len] == b[len]; len++);
+  return len < max_len ? len : max_len;
+}
+
+/* Find the longest pattern, up to max_len bytes, starting at buf[pos]
+ * that also starts at one of the previous window positions,
+ * or the first one found of at least the finder's good_len bytes.
+ * avail bytes can be read from buf[pos], patterns do not go past them.
+ * The distance back to the most recent such position is put in distance.
+ * Return the length matched, or 0 if no pattern of at least 2 bytes is found.
+ */
+int match_finder_find (match_finder_t *finder, const uint8_t *buf,
+    uint32_t pos, int max_len, uint32_t avail, uint32_t *distance) {
+  uint32_t cand, lowest, base;
+  int chain, len, best, good_len;
+  const uint8_t *a, *b;
+
+  if (max_len > avail) max_len = avail;
+  if (max_len < 2) return 0;
+  STATS_ADD (finds, 1);
+  good_len = finder->good_len < max_len ? finder->good_len : max_len;
+
+  // Positions are stored + base + 1, anything below lowest is out of the
+  // window or was stored before the last reset
+  base = finder->base + 1;
+  lowest = base + (pos > finder->window ? pos - finder->window : 0);
+  cand = finder->head[PREFIX (buf, pos)];
+  best = 0;
+
+  a = buf + pos;
+  for (chain = finder->max_chain; chain > 0 && cand >= lowest; chain--) {
+    b = buf + (cand - base);
+
+    // Only a position matching the byte past the best pattern can beat it
+    if (b[best] != a[best]) {
+      cand = finder->prev[(cand - 1) & (finder->window - 1)];
+      continue;
+    }
+    len = match_length (a, b, max_len, avail);
+    STATS_ADD (probes, 1);
+
+    if (len > best) {
+      best = len;
+      *distance = a - b;
+      if (best >= good_len) break;
+    }
+    cand = finder->prev[(cand - 1) & (finder->window - 1)];
+  }
+  STATS_HIST (chain_hist, finder->max_chain - chain);
+  return best;
+}
+
+/* Rebase every stored position after the caller discarded the first
+ * shift bytes of its buffer, a multiple of the window. Positions discarded
+ * or stored before the last reset become empty entries.
+ */
+void match_finder_shift (match_finder_t *finder, uint32_t shift) {
+  uint32_t i, lowest;
+
+  lowest = finder->base + shift;
+  for (i = 0; i < MATCH_HEAD_SIZE; i++) {
+    finder->head[i] = finder->head[i] > lowest ? finder->head[i] - shift : 0;
+  }
+  for (i = 0; i < finder->window; i++) {
+    finder->prev[i] = finder->prev[i] > lowest ? finder->prev[i] - shift : 0;
+  }
+}
+
+/* Forget every position stored so far, all below end, to start over on
+ * another buffer. Later positions are stored past them, so this is O(1)
+ * but for clearing the tables once in a while, when stored positions
+ * could overflow before MATCH_MAX_POS.
+ */
+void match_finder_reset (match_finder_t *finder, uint32_t end) {
+  uint32_t used = (end + finder->window - 1) & ~(finder->window - 1);
+
+  if (used > UINT32_MAX - MATCH_MAX_POS - finder->base) {
+    memset (finder->head, 0, MATCH_HEAD_SIZE * sizeof (uint32_t));
+    memset (finder->prev, 0, finder->window * sizeof (uint32_t));
+    finder->base = 0;
+  } else {
+    finder->base += used;
+  }
+}
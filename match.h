@@ -0,0 +1,40 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+/* Number of distinct 2 bytes prefixes, the head table is indexed directly
+ * by the first 2 bytes of a pattern so no hashing is needed.
+ */
+#define MATCH_HEAD_SIZE 0x10000
+// Positions given to a finder stay below this between resets
+#define MATCH_MAX_POS 0x80000000u
+
+/* A hash chain match finder over a flat buffer:
+ * head[prefix] is the most recent position starting with prefix and
+ * prev[position % window] links to the previous position with the same
+ * prefix. Positions are stored as base + position + 1 so 0 means no entry.
+ * Entries too far behind to be pointed to are rejected by comparing
+ * positions, so nothing ever has to be deleted: a reset only moves base,
+ * a multiple of window, past every position stored so far.
+ * A lookup follows at most max_chain links and stops early once a pattern
+ * of good_len bytes is found.
+ */
+typedef struct match_finder {
+  uint32_t *head;
+  uint32_t *prev;
+  uint32_t base;
+  uint32_t window;
+  int max_chain;
+  int good_len;
+} match_finder_t;
+
+match_finder_t* match_finder_new (uint32_t window, int max_chain,
+    int good_len);
+void match_finder_destroy (match_finder_t **finder_ptr);
+void match_finder_insert (match_finder_t *finder, const uint8_t *buf,
+    uint32_t pos);
+int match_finder_find (match_finder_t *finder, const uint8_t *buf,
+    uint32_t pos, int max_len, uint32_t avail, uint32_t *distance);
+void match_finder_shift (match_finder_t *finder, uint32_t shift);
+void match_finder_reset (match_finder_t *finder, uint32_t end);
+
+#endif
@@ -0,0 +1,330 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "compression.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "ring.h"
+#include "stats.h"
+
+/* A block of input or output, len bytes of data being used.
+ * The last block of a stage has last set, with len 0 for input.
+ */
+typedef struct pipeline_block {
+  uint8_t *data;
+  size_t len;
+  int last;
+} pipeline_block_t;
+
+/* Blocks go round from the reader to the codec through read_full and back
+ * through read_free, and from the codec to the writer through write_full and
+ * back through write_free. Every ring has one producer and one consumer.
+ * Exactly one of cstream and dstream is set.
+ */
+typedef struct pipeline {
+  FILE *in, *out;
+  lz77_cstream_t *cstream;
+  lz77_dstream_t *dstream;
+  pipeline_block_t blocks[PIPELINE_BLOCKS * 2];
+  ring_t *read_free, *read_full, *write_free, *write_full;
+  // Set by any stage failing, the others then only pass their blocks on
+  // until the last one
+  _Atomic int failed;
+} pipeline_t;
+
+static void* pipeline_reader (void *arg) {
+  pipeline_t *pipe = arg;
+  pipeline_block_t *block;
+  int last;
+  STATS_TIMER (start);
+
+  do {
+    block = ring_pop (pipe->read_free);
+    block->len = 0;
+    if (!atomic_load (&pipe->failed)) {
+      STATS_START (start);
+      block->len = fread (block->data, 1, PIPELINE_BLOCK_SIZE, pipe->in);
+      STATS_STOP (read_time, start);
+      if (block->len == 0 && ferror (pipe->in)) {
+        perror ("fread");
+        atomic_store (&pipe->failed, 1);
+      }
+    }
+    last = block->last = (block->len == 0);
+    ring_push (pipe->read_full, block);
+  } while (!last);
+  STATS_FOLD ();
+  return NULL;
+}
+
+static void* pipeline_writer (void *arg) {
+  pipeline_t *pipe = arg;
+  pipeline_block_t *block;
+  int last;
+  STATS_TIMER (start);
+
+  do {
+    block = ring_pop (pipe->write_full);
+    last = block->last;
+    if (block->len && !atomic_load (&pipe->failed)) {
+      STATS_START (start);
+      if (fwrite (block->data, 1, block->len, pipe->out) != block->len) {
+        perror ("fwrite");
+        atomic_store (&pipe->failed, 1);
+      }
+      STATS_STOP (write_time, start);
+    }
+    ring_push (pipe->write_free, block);
+  } while (!last);
+  STATS_FOLD ();
+  return NULL;
+}
+
+static int codec_update (pipeline_t *pipe, const uint8_t *src,
+    size_t src_len, size_t *src_used, pipeline_block_t *out) {
+  size_t n;
+  int result;
+
+  if (pipe->cstream) {
+    result = lz77_cstream_update (pipe->cstream, src, src_len, src_used,
+        out->data + out->len, PIPELINE_BLOCK_SIZE - out->len, &n);
+  } else {
+    result = lz77_dstream_update (pipe->dstream, src, src_len, src_used,
+        out->data + out->len, PIPELINE_BLOCK_SIZE - out->len, &n);
+  }
+  out->len += n;
+  return result;
+}
+
+static int codec_finish (pipeline_t *pipe, pipeline_block_t *out) {
+  size_t n;
+  int result;
+
+  if (pipe->cstream) {
+    result = lz77_cstream_finish (pipe->cstream, out->data + out->len,
+        PIPELINE_BLOCK_SIZE - out->len, &n);
+  } else {
+    result = lz77_dstream_finish (pipe->dstream, out->data + out->len,
+        PIPELINE_BLOCK_SIZE - out->len, &n);
+  }
+  out->len += n;
+  return result;
+}
+
+/* Hand a full block of output to the writer and take an empty one
+ */
+static pipeline_block_t* next_output (pipeline_t *pipe,
+    pipeline_block_t *out) {
+  ring_push (pipe->write_full, out);
+  out = ring_pop (pipe->write_free);
+  out->len = 0;
+  out->last = 0;
+  return out;
+}
+
+/* Run the codec on the calling thread over the blocks of the reader,
+ * total being the size of the input for progress, 0 if unknown
+ */
+static void run_codec (pipeline_t *pipe, uint64_t total) {
+  pipeline_block_t *in, *out;
+  size_t pos, n;
+  uint64_t done;
+  int last, result;
+
+  out = ring_pop (pipe->write_free);
+  out->len = 0;
+  out->last = 0;
+  done = 0;
+  do {
+    in = ring_pop (pipe->read_full);
+    last = in->last;
+    for (pos = 0; pos < in->len && !atomic_load (&pipe->failed); pos += n) {
+      if (codec_update (pipe, in->data + pos, in->len - pos, &n, out) != 0) {
+        if (pipe->cstream) {
+          fprintf (stderr, "Compression failed\n");
+        } else {
+          fprintf (stderr, "Invalid pointer at byte %llu\n",
+              (unsigned long long) (done + pos + n));
+        }
+        atomic_store (&pipe->failed, 1);
+      }
+      if (out->len == PIPELINE_BLOCK_SIZE) out = next_output (pipe, out);
+    }
+    done += in->len;
+    ring_push (pipe->read_free, in);
+    progress_report (done, total, last);
+  } while (!last);
+
+  while (!atomic_load (&pipe->failed)) {
+    result = codec_finish (pipe, out);
+    if (result < 0) {
+      fprintf (stderr, pipe->cstream ? "Compression failed\n"
+          : "Truncated file\n");
+      atomic_store (&pipe->failed, 1);
+    }
+    if (result <= 0) break;
+    out = next_output (pipe, out);
+  }
+  out->last = 1;
+  ring_push (pipe->write_full, out);
+}
+
+/* Run a pipeline whose codec is set, closing both files.
+ * Return 0 for success and -1 for failure.
+ */
+static int run_pipeline (pipeline_t *pipe) {
+  pthread_t reader, writer;
+  pipeline_block_t *block;
+  struct stat file_stat;
+  uint64_t total;
+  int i, reading, writing;
+
+  for (i = 0; i < PIPELINE_BLOCKS * 2; i++) {
+    ring_push (i < PIPELINE_BLOCKS ? pipe->read_free : pipe->write_free,
+        pipe->blocks + i);
+  }
+  // The size is only used to report progress, unknown for pipes
+  total = 0;
+  if (fstat (fileno (pipe->in), &file_stat) == 0
+      && S_ISREG (file_stat.st_mode)) {
+    total = file_stat.st_size;
+  }
+
+  // A stage failing to start is stood in for by a failed pipeline: a last
+  // empty block of input and no output
+  writing = pthread_create (&writer, NULL, pipeline_writer, pipe) == 0;
+  reading = writing
+    && pthread_create (&reader, NULL, pipeline_reader, pipe) == 0;
+  if (!reading) {
+    perror ("pthread_create");
+    atomic_store (&pipe->failed, 1);
+    block = ring_pop (pipe->read_free);
+    block->len = 0;
+    block->last = 1;
+    ring_push (pipe->read_full, block);
+  }
+  if (writing) {
+    run_codec (pipe, total);
+    pthread_join (writer, NULL);
+  }
+  if (reading) pthread_join (reader, NULL);
+
+  if (fclose (pipe->out) != 0) {
+    perror ("fclose");
+    atomic_store (&pipe->failed, 1);
+  }
+  fclose (pipe->in);
+  return atomic_load (&pipe->failed) ? -1 : 0;
+}
+
+static pipeline_t* pipeline_new (FILE *in, FILE *out) {
+  pipeline_t *pipe;
+  int i;
+
+  pipe = calloc (1, sizeof (pipeline_t));
+  if (!pipe) return NULL;
+  pipe->in = in;
+  pipe->out = out;
+  atomic_init (&pipe->failed, 0);
+  pipe->read_free = ring_new (PIPELINE_BLOCKS);
+  pipe->read_full = ring_new (PIPELINE_BLOCKS);
+  pipe->write_free = ring_new (PIPELINE_BLOCKS);
+  pipe->write_full = ring_new (PIPELINE_BLOCKS);
+  for (i = 0; i < PIPELINE_BLOCKS * 2; i++) {
+    pipe->blocks[i].data = malloc (PIPELINE_BLOCK_SIZE);
+    if (!pipe->blocks[i].data) atomic_store (&pipe->failed, 1);
+  }
+  return pipe;
+}
+
+static void pipeline_destroy (pipeline_t **pipe_ptr) {
+  pipeline_t *pipe = *pipe_ptr;
+  int i;
+
+  if (pipe->read_free) ring_destroy (&pipe->read_free);
+  if (pipe->read_full) ring_destroy (&pipe->read_full);
+  if (pipe->write_free) ring_destroy (&pipe->write_free);
+  if (pipe->write_full) ring_destroy (&pipe->write_full);
+  for (i = 0; i < PIPELINE_BLOCKS * 2; i++) {
+    free (pipe->blocks[i].data);
+  }
+  if (pipe->cstream) lz77_cstream_destroy (&pipe->cstream);
+  if (pipe->dstream) lz77_dstream_destroy (&pipe->dstream);
+  free (pipe);
+  *pipe_ptr = NULL;
+}
+
+/* Return 1 if pipe was set up with its codec, 0 otherwise
+ */
+static int pipeline_ready (pipeline_t *pipe) {
+  return pipe && pipe->read_free && pipe->read_full && pipe->write_free
+    && pipe->write_full && !atomic_load (&pipe->failed)
+    && (pipe->cstream || pipe->dstream);
+}
+
+int compress_pipelined (FILE *in, FILE *out, int level,
+    const uint8_t *dict, size_t dict_len) {
+  pipeline_t *pipe;
+  int result;
+  STATS_TIMER (start);
+
+  STATS_START (start);
+  pipe = pipeline_new (in, out);
+  if (pipe) {
+    pipe->cstream = lz77_cstream_new (level);
+    if (pipe->cstream
+        && lz77_cstream_set_dict (pipe->cstream, dict, dict_len) != 0) {
+      lz77_cstream_destroy (&pipe->cstream);
+    }
+  }
+  if (!pipeline_ready (pipe)) {
+    perror ("compress_pipelined");
+    if (pipe) pipeline_destroy (&pipe);
+    fclose (in);
+    fclose (out);
+    return -1;
+  }
+
+  fprintf (stderr, "Compressing...\n");
+  result = run_pipeline (pipe);
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+  pipeline_destroy (&pipe);
+  STATS_STOP (compress_time, start);
+  STATS_FOLD ();
+  return result;
+}
+
+int decompress_pipelined (FILE *in, FILE *out,
+    const uint8_t *dict, size_t dict_len) {
+  pipeline_t *pipe;
+  int result;
+  STATS_TIMER (start);
+
+  STATS_START (start);
+  pipe = pipeline_new (in, out);
+  if (pipe) {
+    pipe->dstream = lz77_dstream_new ();
+    if (pipe->dstream
+        && lz77_dstream_set_dict (pipe->dstream, dict, dict_len) != 0) {
+      lz77_dstream_destroy (&pipe->dstream);
+    }
+  }
+  if (!pipeline_ready (pipe)) {
+    perror ("decompress_pipelined");
+    if (pipe) pipeline_destroy (&pipe);
+    fclose (in);
+    fclose (out);
+    return -1;
+  }
+
+  fprintf (stderr, "Decompressing...\n");
+  result = run_pipeline (pipe);
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+  pipeline_destroy (&pipe);
+  STATS_STOP (decompress_time, start);
+  STATS_FOLD ();
+  return result;
+}
@@ -0,0 +1,22 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// Size of the blocks read from the input and written to the output
+#define PIPELINE_BLOCK_SIZE 0x100000
+// Blocks between the reader and the codec, and between the codec and the
+// writer, 2 at least so one is filled while the other is drained
+#define PIPELINE_BLOCKS 4
+
+/* Compress or decompress a headerless stream as compress_file_dict and
+ * decompress_file_dict do, on three threads: a reader filling blocks of
+ * input, the calling thread compressing or decompressing them, and a writer
+ * draining blocks of output, so reads and writes waiting on the disk or
+ * the network overlap with the codec.
+ * Both files are closed. Return 0 for success and -1 for failure.
+ */
+int compress_pipelined (FILE *in, FILE *out, int level,
+    const uint8_t *dict, size_t dict_len);
+int decompress_pipelined (FILE *in, FILE *out,
+    const uint8_t *dict, size_t dict_len);
+
+#endif
@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "pool.h"
+
+static void* pool_worker (void *arg) {
+  pool_t *pool = arg;
+  pool_job_t *job;
+
+  pthread_mutex_lock (&pool->lock);
+  while (1) {
+    while (!pool->head && !pool->quit) {
+      pthread_cond_wait (&pool->submitted, &pool->lock);
+    }
+    if (!pool->head) break;
+
+    job = pool->head;
+    pool->head = job->next;
+    if (!pool->head) pool->tail = NULL;
+    pthread_mutex_unlock (&pool->lock);
+
+    job->run (job);
+
+    pthread_mutex_lock (&pool->lock);
+    job->done = 1;
+    pthread_cond_broadcast (&pool->finished);
+  }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* Start a pool of size worker threads.
+ * Return NULL for failure.
+ */
+pool_t* pool_new (int size) {
+  pool_t *pool;
+
+  pool = malloc (sizeof (pool_t));
+  if (!pool) return NULL;
+  pool->threads = malloc (sizeof (pthread_t) * size);
+  if (!pool->threads) {
+    free (pool);
+    return NULL;
+  }
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->submitted, NULL);
+  pthread_cond_init (&pool->finished, NULL);
+  pool->head = NULL;
+  pool->tail = NULL;
+  pool->quit = 0;
+
+  for (pool->size = 0; pool->size < size; pool->size++) {
+    if (pthread_create (pool->threads + pool->size, NULL, pool_worker, pool)) {
+      break;
+    }
+  }
+  if (pool->size == 0) {
+    pool_destroy (&pool);
+  }
+  return pool;
+}
+
+/* Run the jobs still queued then stop the workers
+ */
+void pool_destroy (pool_t **pool_ptr) {
+  pool_t *pool = *pool_ptr;
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast (&pool->submitted);
+  pthread_mutex_unlock (&pool->lock);
+  for (i = 0; i < pool->size; i++) {
+    pthread_join (pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->submitted);
+  pthread_cond_destroy (&pool->finished);
+  free (pool->threads);
+  free (pool);
+  *pool_ptr = NULL;
+}
+
+/* Queue job to be run by the next idle worker. job->run must be set,
+ * and job must not be reused before pool_wait returns for it.
+ */
+void pool_submit (pool_t *pool, pool_job_t *job) {
+  job->next = NULL;
+  job->done = 0;
+  pthread_mutex_lock (&pool->lock);
+  if (pool->tail) {
+    pool->tail->next = job;
+  } else {
+    pool->head = job;
+  }
+  pool->tail = job;
+  pthread_cond_signal (&pool->submitted);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Wait until a submitted job has been run
+ */
+void pool_wait (pool_t *pool, pool_job_t *job) {
+  pthread_mutex_lock (&pool->lock);
+  while (!job->done) {
+    pthread_cond_wait (&pool->finished, &pool->lock);
+  }
+  pthread_mutex_unlock (&pool->lock);
+}
@@ -0,0 +1,31 @@
+#ifndef POOL_H
+#define POOL_H
+
+/* A job run by a worker of a pool:
+ * Callers embed it as the first member of their own structure
+ * and cast back to it in run.
+ */
+typedef struct pool_job {
+  void (*run) (struct pool_job *job);
+  struct pool_job *next;
+  int done;
+} pool_job_t;
+
+/* A fixed number of worker threads running jobs in submission order
+ */
+typedef struct pool {
+  pthread_t *threads;
+  int size;
+  pthread_mutex_t lock;
+  pthread_cond_t submitted;
+  pthread_cond_t finished;
+  pool_job_t *head, *tail;
+  int quit;
+} pool_t;
+
+pool_t* pool_new (int size);
+void pool_destroy (pool_t **pool_ptr);
+void pool_submit (pool_t *pool, pool_job_t *job);
+void pool_wait (pool_t *pool, pool_job_t *job);
+
+#endif
@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "progress.h"
+
+static progress_fn progress_callback = NULL;
+static void *progress_arg = NULL;
+static double progress_last = 0;
+
+/* Have fn called with arg to report the progress of compressions and
+ * decompressions of files, NULL to report nothing.
+ */
+void progress_set (progress_fn fn, void *arg) {
+  progress_callback = fn;
+  progress_arg = arg;
+  progress_last = 0;
+}
+
+/* Pass the progress to the callback set, if any, at most once every
+ * PROGRESS_INTERVAL unless last is set.
+ */
+void progress_report (uint64_t done, uint64_t total, int last) {
+  struct timespec t;
+  double now;
+
+  if (!progress_callback) {
+    return;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  now = t.tv_sec + t.tv_nsec / 1e9;
+  if (last || now - progress_last >= PROGRESS_INTERVAL) {
+    progress_last = now;
+    progress_callback (done, total, last, progress_arg);
+  }
+}
@@ -0,0 +1,16 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+// Least time between two progress reports, in seconds
+#define PROGRESS_INTERVAL 0.1
+
+/* Called with the bytes done so far out of total, 0 when unknown,
+ * last being set for the final report of a file
+ */
+typedef void (*progress_fn) (uint64_t done, uint64_t total, int last,
+    void *arg);
+
+void progress_set (progress_fn fn, void *arg);
+void progress_report (uint64_t done, uint64_t total, int last);
+
+#endif
@@ -0,0 +1,134 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ring.h"
+
+/* Create a ring of at least size pointers, rounded up to a power of 2.
+ * Return NULL for failure.
+ */
+ring_t* ring_new (uint32_t size) {
+  ring_t *ring;
+  uint32_t rounded;
+
+  for (rounded = 1; rounded < size; rounded *= 2);
+  ring = malloc (sizeof (ring_t));
+  if (!ring) return NULL;
+  ring->slots = malloc (sizeof (void*) * rounded);
+  if (!ring->slots) {
+    free (ring);
+    return NULL;
+  }
+  ring->mask = rounded - 1;
+  atomic_init (&ring->head, 0);
+  atomic_init (&ring->tail, 0);
+  atomic_init (&ring->waiting, 0);
+  pthread_mutex_init (&ring->lock, NULL);
+  pthread_cond_init (&ring->changed, NULL);
+  return ring;
+}
+
+void ring_destroy (ring_t **ring_ptr) {
+  ring_t *ring = *ring_ptr;
+  pthread_mutex_destroy (&ring->lock);
+  pthread_cond_destroy (&ring->changed);
+  free (ring->slots);
+  free (ring);
+  *ring_ptr = NULL;
+}
+
+/* Wake the other side if it sleeps.
+ * The positions and waiting are sequentially consistent: a side going to
+ * sleep counts itself in waiting before looking at the positions again, and
+ * a side moving a position looks at waiting after, so either the sleeper
+ * sees the move or the mover sees the sleeper.
+ */
+static void ring_wake (ring_t *ring) {
+  if (atomic_load (&ring->waiting)) {
+    pthread_mutex_lock (&ring->lock);
+    pthread_cond_broadcast (&ring->changed);
+    pthread_mutex_unlock (&ring->lock);
+  }
+}
+
+static int ring_put (ring_t *ring, void *item) {
+  uint32_t tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+
+  if (tail - atomic_load (&ring->head) > ring->mask) {
+    return 0;
+  }
+  ring->slots[tail & ring->mask] = item;
+  atomic_store (&ring->tail, tail + 1);
+  return 1;
+}
+
+static void* ring_take (ring_t *ring) {
+  uint32_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  void *item;
+
+  if (head == atomic_load (&ring->tail)) {
+    return NULL;
+  }
+  item = ring->slots[head & ring->mask];
+  atomic_store (&ring->head, head + 1);
+  return item;
+}
+
+/* Push item, not NULL, from the producer thread unless ring is full.
+ * Return 1 if it was pushed, 0 otherwise.
+ */
+int ring_try_push (ring_t *ring, void *item) {
+  if (!ring_put (ring, item)) {
+    return 0;
+  }
+  ring_wake (ring);
+  return 1;
+}
+
+/* Pop the oldest item from the consumer thread.
+ * Return NULL if ring is empty.
+ */
+void* ring_try_pop (ring_t *ring) {
+  void *item = ring_take (ring);
+  if (item) ring_wake (ring);
+  return item;
+}
+
+/* Push item, not NULL, from the producer thread, waiting while ring is full
+ */
+void ring_push (ring_t *ring, void *item) {
+  int spin;
+
+  for (spin = 0; spin < RING_SPIN; spin++) {
+    if (ring_try_push (ring, item)) return;
+  }
+  pthread_mutex_lock (&ring->lock);
+  atomic_fetch_add (&ring->waiting, 1);
+  while (!ring_put (ring, item)) {
+    pthread_cond_wait (&ring->changed, &ring->lock);
+  }
+  atomic_fetch_sub (&ring->waiting, 1);
+  pthread_cond_broadcast (&ring->changed);
+  pthread_mutex_unlock (&ring->lock);
+}
+
+/* Pop the oldest item from the consumer thread, waiting while ring is empty
+ */
+void* ring_pop (ring_t *ring) {
+  void *item;
+  int spin;
+
+  for (spin = 0; spin < RING_SPIN; spin++) {
+    item = ring_try_pop (ring);
+    if (item) return item;
+  }
+  pthread_mutex_lock (&ring->lock);
+  atomic_fetch_add (&ring->waiting, 1);
+  while (!(item = ring_take (ring))) {
+    pthread_cond_wait (&ring->changed, &ring->lock);
+  }
+  atomic_fetch_sub (&ring->waiting, 1);
+  pthread_cond_broadcast (&ring->changed);
+  pthread_mutex_unlock (&ring->lock);
+  return item;
+}
@@ -0,0 +1,34 @@
+#ifndef RING_H
+#define RING_H
+
+// Cache line size, keeping the positions of the producer and consumer apart
+#define RING_LINE 64
+// Attempts to push to a full or pop from an empty ring before sleeping
+#define RING_SPIN 100
+
+/* A bounded queue of pointers between one producer thread and one consumer
+ * thread, its size a power of 2:
+ * tail is only written by the producer and head by the consumer, so pushes
+ * and pops take no lock. Only a thread finding the ring full or empty
+ * sleeps, on changed, waking once the other side has moved.
+ */
+typedef struct ring {
+  void **slots;
+  uint32_t mask;
+  _Atomic uint32_t head;
+  uint8_t head_pad[RING_LINE];
+  _Atomic uint32_t tail;
+  uint8_t tail_pad[RING_LINE];
+  _Atomic int waiting;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} ring_t;
+
+ring_t* ring_new (uint32_t size);
+void ring_destroy (ring_t **ring_ptr);
+int ring_try_push (ring_t *ring, void *item);
+void* ring_try_pop (ring_t *ring);
+void ring_push (ring_t *ring, void *item);
+void* ring_pop (ring_t *ring);
+
+#endif
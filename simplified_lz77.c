@@ -1,19 +1,273 @@
+#include <errno.h>
+#include <getopt.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "batch.h"
 #include "compression.h"
+#include "dict.h"
+#include "format.h"
+#include "frame.h"
+#include "mapped.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "stats.h"
+
+/* Decompress a mapped framed file to a mapped file of the exact size,
+ * with threads workers decompressing blocks straight to their place.
+ * Return 1 if done and -1 for failure.
+ */
+int run_mapped_framed (mapped_file_t *in, char *output_filename,
+    int threads) {
+  int result;
+  uint64_t len;
+  mapped_file_t *out;
+
+  if (framed_size (in->data, in->size, &len) < 0) {
+    mapped_file_close (&in, in->size);
+    return -1;
+  }
+  out = mapped_file_create (output_filename, len, 1);
+  if (!out) {
+    fprintf (stderr, "Failed to map file %s: %s\n", output_filename,
+        strerror (errno));
+    mapped_file_close (&in, in->size);
+    return -1;
+  }
+
+  fprintf (stderr, "Decompressing...\n");
+  result = decompress_framed_buffer (in->data, in->size, out->data, threads);
+  fprintf (stderr, result == 0 ? "Done\n" : "Failed\n");
+
+  mapped_file_close (&in, in->size);
+  if (mapped_file_close (&out, result == 0 ? len : 0) != 0) {
+    result = -1;
+  }
+  return result == 0 ? 1 : -1;
+}
+
+/* Compress at level or decompress a regular file through memory maps,
+ * with the dict_len bytes of dict as a preset dictionary if not 0.
+ * Return 1 if done, 0 if the input or the output cannot be mapped and
+ * stdio should be used instead, -1 for failure.
+ */
+int run_mapped (int compress, int level, int threads, char *input_filename,
+    char *output_filename, const uint8_t *dict, size_t dict_len) {
+  int result;
+  size_t len, header, format;
+  const uint8_t *src;
+  mapped_file_t *in, *out;
+
+  if (!mapped_file_can_create (output_filename)) {
+    return 0;
+  }
+  in = mapped_file_open (input_filename);
+  if (!in) {
+    return 0;
+  }
+  if (!compress && is_framed (in->data, in->size)) {
+    return run_mapped_framed (in, output_filename, threads ? threads : 1);
+  }
+
+  // A format header then a dictionary header go before the stream
+  format = compress ? FORMAT_HEADER_LEN : 0;
+  header = format + (compress && dict_len ? DICT_HEADER_SIZE : 0);
+  src = in->data;
+  len = in->size;
+  if (!compress) {
+    format = format_skip_header (src, len);
+    if (format == (size_t) -1) {
+      mapped_file_close (&in, in->size);
+      return -1;
+    }
+    src += format;
+    len -= format;
+  }
+  if (!compress && is_dict_header (src, len)) {
+    if (dict_check (dict_header_id (src), dict, dict_len) != 0) {
+      mapped_file_close (&in, in->size);
+      return -1;
+    }
+    src += DICT_HEADER_SIZE;
+    len -= DICT_HEADER_SIZE;
+  }
+
+  // The compressed size is close to its bound, reserve it on disk
+  len = compress ? header + compress_bound (len) : decompress_bound (len);
+  out = mapped_file_create (output_filename, len, compress);
+  if (!out) {
+    fprintf (stderr, "Failed to map file %s: %s\n", output_filename,
+        strerror (errno));
+    mapped_file_close (&in, in->size);
+    return -1;
+  }
+
+  if (compress) {
+    fprintf (stderr, "Compressing...\n");
+    if (format) {
+      format_put_header (out->data);
+    }
+    if (dict_len) {
+      dict_put_header (out->data + format, dict_id (dict, dict_len));
+    }
+    result = compress_buffer_dict (in->data, in->size, out->data + header,
+        out->size - header, &len, level, dict, dict_len);
+    len += header;
+  } else {
+    fprintf (stderr, "Decompressing...\n");
+    result = decompress_buffer_dict (src, in->data + in->size - src,
+        out->data, out->size, &len, dict, dict_len);
+  }
+  if (result != 0) {
+    fprintf (stderr, "Failed to %s file %s\n",
+        compress ? "compress" : "decompress", input_filename);
+    len = 0;
+  } else {
+    fprintf (stderr, "Done\n");
+  }
+
+  mapped_file_close (&in, in->size);
+  if (mapped_file_close (&out, len) != 0) {
+    perror ("ftruncate");
+    result = -1;
+  }
+  return result == 0 ? 1 : -1;
+}
+
+/* Open filename in mode, "-" being stdin or stdout.
+ * Return NULL for failure.
+ */
+FILE* open_file (char *filename, char *mode) {
+  FILE *file;
+
+  if (strcmp (filename, "-") == 0) {
+    return mode[0] == 'r' ? stdin : stdout;
+  }
+  file = fopen (filename, mode);
+  if (!file) {
+    fprintf (stderr, "Failed to open file %s\n", filename);
+    perror ("fopen");
+  }
+  return file;
+}
+
+/* Print the progress on stderr, as a percentage when total is known,
+ * on a line of its own once last
+ */
+void print_progress (uint64_t done, uint64_t total, int last, void *arg) {
+  // Every report overwrites the one before it, the last one is kept
+  if (total) {
+    fprintf (stderr, "\r%5.1f%%%s", 100.0 * done / total, last ? "\n" : "");
+  } else {
+    fprintf (stderr, "\r%lu MB%s", (unsigned long) (done >> 20),
+        last ? "\n" : "");
+  }
+}
+
+/* Print the counters gathered on stderr
+ */
+void print_stats () {
+  lz77_stats_t stats;
+
+  if (lz77_stats_get (&stats) != 0) {
+    fprintf (stderr, "No statistics, built without LZ77_STATS\n");
+    return;
+  }
+  lz77_stats_print (stderr, &stats);
+}
+
+/* Read the last PTR_SIZE bytes at most of filename, the part of a
+ * dictionary that can be pointed to, to dict. The number of bytes read
+ * is put in dict_len.
+ * Return 0 for success and -1 for failure.
+ */
+int load_dict (char *filename, uint8_t *dict, size_t *dict_len) {
+  FILE *file;
+  long size;
+
+  file = fopen (filename, "rb");
+  if (!file) {
+    fprintf (stderr, "Failed to open file %s\n", filename);
+    perror ("fopen");
+    return -1;
+  }
+  if (fseek (file, 0, SEEK_END) != 0 || (size = ftell (file)) < 0
+      || fseek (file, size > PTR_SIZE ? size - PTR_SIZE : 0, SEEK_SET) != 0) {
+    fprintf (stderr, "Failed to read file %s\n", filename);
+    perror ("fseek");
+    fclose (file);
+    return -1;
+  }
+  *dict_len = fread (dict, 1, PTR_SIZE, file);
+  fclose (file);
+  return 0;
+}
+
+void usage (char *name) {
+  printf ("Usage:\n%s -d FILE OUTPUT to decompress FILE\n"
+      "%s -c FILE OUTPUT to compress FILE\n"
+      "FILE or OUTPUT can be - for stdin or stdout\n"
+      "%s -b -c FILE... to compress every FILE to FILE" BATCH_SUFFIX "\n"
+      "%s -b -d FILE... to decompress every FILE" BATCH_SUFFIX " to FILE\n"
+      "FILE can be a directory, for its files\n"
+      "Options:\n"
+      "  -T N     compress blocks of FILE on N threads, in the framed format,\n"
+      "           or decompress blocks of a framed FILE on N threads,\n"
+      "           or run -b on N threads\n"
+      "  -P N     compress blocks of FILE on N threads to one headerless\n"
+      "           stream, read as if compressed without -P\n"
+      "  -o DIR   write the outputs of -b to DIR instead of next to the files\n"
+      "  -B SIZE  size of the blocks in bytes for -T and -P, default %d\n"
+      "  -1 .. -9 compress faster (-1) or better (-9), default -%d\n"
+      "  -O       compress best, picking the commands taking the fewest bits\n"
+      "  -D DICT  compress with the preset dictionary DICT, see lz77_train,\n"
+      "           or decompress a file compressed with it\n"
+      "  --pipeline  read, compress or decompress, and write on three\n"
+      "           threads, for files on slow disks or the network,\n"
+      "           not with -T, -P, -b or a framed FILE\n"
+      "  --stats  print counters of the matcher, tokens and I/O when done,\n"
+      "           if built with make STATS=1\n",
+      name, name, name, name, FRAME_BLOCK_SIZE, COMPRESS_DEFAULT_LEVEL);
+}
 
 int main (int argc, char* argv[]) {
+  static const struct option long_options[] = {
+    {"stats", no_argument, NULL, 'S'},
+    {"pipeline", no_argument, NULL, 'p'},
+    {NULL, 0, NULL, 0}
+  };
   int c;
-  int compress;
+  int compress, level, threads, spliced, pipelined, stats, batch, result;
+  long block_size;
+  uint8_t *dict, header[DICT_HEADER_SIZE];
+  size_t dict_len;
   char* input_filename;
+  char *output_dir;
+  char **inputs;
   FILE *in, *out;
 
   compress = -1;
+  level = COMPRESS_DEFAULT_LEVEL;
+  threads = 0;
+  spliced = 0;
+  pipelined = 0;
+  stats = 0;
+  batch = 0;
+  input_filename = NULL;
+  output_dir = NULL;
+  dict_len = 0;
+  block_size = FRAME_BLOCK_SIZE;
+  // PTR_SIZE bytes is too much for the stack with the wider formats
+  dict = malloc (PTR_SIZE);
+  if (!dict) {
+    perror ("malloc");
+    return 1;
+  }
   opterr = 0;
-  while ((c = getopt (argc, argv, "c:d:")) != -1) {
+  while ((c = getopt_long (argc, argv, "c:d:T:P:B:D:bo:123456789O",
+          long_options, NULL)) != -1) {
     switch (c) {
       case 'c':
         input_filename = optarg;
@@ -23,38 +277,187 @@ int main (int argc, char* argv[]) {
         input_filename = optarg;
         compress = 0;
         break;
+      case 'T':
+      case 'P':
+        threads = atoi (optarg);
+        if (threads < 1) {
+          usage (argv[0]);
+          return 1;
+        }
+        spliced = (c == 'P');
+        break;
+      case 'B':
+        block_size = atol (optarg);
+        if (block_size < 1 || block_size > FRAME_MAX_BLOCK_SIZE) {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      case 'D':
+        if (load_dict (optarg, dict, &dict_len) != 0) {
+          return 1;
+        }
+        break;
+      case '1': case '2': case '3': case '4': case '5':
+      case '6': case '7': case '8': case '9':
+        level = c - '0';
+        break;
+      case 'O':
+        level = COMPRESS_MAX_LEVEL;
+        break;
+      case 'b':
+        batch = 1;
+        break;
+      case 'o':
+        output_dir = optarg;
+        break;
+      case 'S':
+        stats = 1;
+        break;
+      case 'p':
+        pipelined = 1;
+        break;
       default:
-        printf ("Usage:\n%s -d FILE OUTPUT to decompress FILE\n"
-            "%s -c FILE OUTPUT to compress FILE\n", argv[0], argv[0]);
+        usage (argv[0]);
         return 1;
     }
   }
 
-  if (compress == -1 || optind >= argc) {
-    printf ("Usage:\n%s -d FILE OUTPUT to decompress FILE\n"
-        "%s -c FILE OUTPUT to compress FILE\n", argv[0], argv[0]);
+  if (compress == -1 || (!batch && optind >= argc)) {
+    usage (argv[0]);
     return 1;
   }
 
-  in = fopen (input_filename, "rb");
-  if (!in) {
-    printf ("Failed to open file %s\n", input_filename);
-    perror ("fopen");
+  // The other threaded modes overlap reads and writes with their workers
+  // already, --pipeline only runs one headerless stream
+  if (pipelined && (threads || batch)) {
+    fprintf (stderr, "--pipeline cannot be used with -T, -P or -b\n");
+    return 1;
+  }
+
+  progress_set (print_progress, NULL);
+
+  // Every file given after the options is one more input
+  if (batch) {
+    inputs = malloc ((argc - optind + 1) * sizeof (char*));
+    if (!inputs) {
+      perror ("malloc");
+      return 1;
+    }
+    inputs[0] = input_filename;
+    memcpy (inputs + 1, argv + optind, (argc - optind) * sizeof (char*));
+    result = run_batch (compress, inputs, argc - optind + 1, output_dir,
+        threads ? threads : 1, level, dict, dict_len);
+    free (inputs);
+    free (dict);
+    if (stats) print_stats ();
+    return result == 0 ? 0 : 1;
+  }
+  if (compress && threads && !spliced && dict_len) {
+    fprintf (stderr, "-D cannot be used with -T\n");
     return 1;
   }
 
-  out = fopen (argv[optind], "wb");
+  // Regular files are mapped, anything else goes through stdio
+  if ((!compress || !threads) && !pipelined && strcmp (input_filename, "-") != 0
+      && strcmp (argv[optind], "-") != 0) {
+    result = run_mapped (compress, level, threads, input_filename,
+        argv[optind], dict, dict_len);
+    if (result != 0) {
+      free (dict);
+      if (stats) print_stats ();
+      return result == 1 ? 0 : 1;
+    }
+  }
+
+  in = open_file (input_filename, "rb");
+  if (!in) {
+    return 1;
+  }
+  out = open_file (argv[optind], "wb");
   if (!out) {
-    printf("Failed to open file %s\n", argv[optind]);
-    perror ("fopen");
     return 1;
   }
 
+  result = 0;
   if (!compress) {
-    decompress_file (in, out);
+    // A headerless stream starts with a 0 bit, a frame, a format or a
+    // dictionary header with a 1 bit
+    c = fgetc (in);
+    if (c == (uint8_t) FORMAT_MAGIC[0]) {
+      header[0] = c;
+      if (fread (header + 1, 1, FORMAT_HEADER_SIZE - 1, in)
+          != FORMAT_HEADER_SIZE - 1
+          || !is_format_header (header, FORMAT_HEADER_SIZE)) {
+        fprintf (stderr, "Invalid format header\n");
+        return 1;
+      }
+      if (format_check (header[4]) != 0) {
+        return 1;
+      }
+      c = fgetc (in);
+    } else if (!(c & 0x80) && format_check (0) != 0) {
+      return 1;
+    }
+    if (c == (uint8_t) DICT_MAGIC[0]) {
+      header[0] = c;
+      if (fread (header + 1, 1, DICT_HEADER_SIZE - 1, in)
+          != DICT_HEADER_SIZE - 1
+          || !is_dict_header (header, DICT_HEADER_SIZE)) {
+        fprintf (stderr, "Invalid dictionary header\n");
+        return 1;
+      }
+      if (dict_check (dict_header_id (header), dict, dict_len) != 0) {
+        return 1;
+      }
+      if (pipelined) {
+        result = decompress_pipelined (in, out, dict, dict_len);
+      } else {
+        result = decompress_file_dict (in, out, dict, dict_len);
+      }
+    } else if (c != EOF && (c & 0x80)) {
+      if (pipelined) {
+        fprintf (stderr, "--pipeline cannot decompress a framed file\n");
+        return 1;
+      }
+      ungetc (c, in);
+      result = decompress_framed (in, out, threads ? threads : 1);
+    } else {
+      if (c != EOF) ungetc (c, in);
+      if (pipelined) {
+        result = decompress_pipelined (in, out, dict, dict_len);
+      } else {
+        result = decompress_file_dict (in, out, dict, dict_len);
+      }
+    }
+  } else if (threads && !spliced) {
+    result = compress_framed (in, out, threads, block_size, level);
   } else {
-    compress_file (in, out);
+    if (LZ77_FORMAT) {
+      format_put_header (header);
+      if (fwrite (header, 1, FORMAT_HEADER_SIZE, out) != FORMAT_HEADER_SIZE) {
+        perror ("fwrite");
+        return 1;
+      }
+    }
+    if (dict_len) {
+      dict_put_header (header, dict_id (dict, dict_len));
+      if (fwrite (header, 1, DICT_HEADER_SIZE, out) != DICT_HEADER_SIZE) {
+        perror ("fwrite");
+        return 1;
+      }
+    }
+    if (spliced) {
+      result = compress_spliced (in, out, threads, block_size, level,
+          dict, dict_len);
+    } else if (pipelined) {
+      result = compress_pipelined (in, out, level, dict, dict_len);
+    } else {
+      result = compress_file_dict (in, out, level, dict, dict_len);
+    }
   }
 
-  return 0;
+  free (dict);
+  if (stats) print_stats ();
+  return result == 0 ? 0 : 1;
 }
@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#ifdef LZ77_STATS
+__thread lz77_stats_t stats_local;
+__thread int stats_paused;
+static lz77_stats_t stats_total;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double stats_now () {
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void add_counts (uint64_t *total, const uint64_t *local, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    total[i] += local[i];
+  }
+}
+
+/* Add the counters of the calling thread to the totals and clear them,
+ * unless paused
+ */
+void stats_fold () {
+  lz77_stats_t *local = &stats_local;
+
+  if (stats_paused) {
+    return;
+  }
+  pthread_mutex_lock (&stats_lock);
+  stats_total.finds += local->finds;
+  stats_total.probes += local->probes;
+  stats_total.inserts += local->inserts;
+  add_counts (stats_total.chain_hist, local->chain_hist, STATS_CHAIN_BUCKETS);
+  stats_total.literals += local->literals;
+  stats_total.pointers += local->pointers;
+  add_counts (stats_total.length_hist, local->length_hist,
+      STATS_LENGTH_BUCKETS);
+  add_counts (stats_total.distance_hist, local->distance_hist,
+      STATS_DISTANCE_BUCKETS);
+  stats_total.bytes_in += local->bytes_in;
+  stats_total.bytes_out += local->bytes_out;
+  stats_total.read_time += local->read_time;
+  stats_total.write_time += local->write_time;
+  stats_total.compress_time += local->compress_time;
+  stats_total.decompress_time += local->decompress_time;
+  pthread_mutex_unlock (&stats_lock);
+  memset (local, 0, sizeof (lz77_stats_t));
+}
+#endif
+
+/* Copy the totals gathered so far to stats, including the counters of the
+ * calling thread, e.g. of streams it drives.
+ * Return 0 for success and -1 if built without counters.
+ */
+int lz77_stats_get (lz77_stats_t *stats) {
+#ifdef LZ77_STATS
+  stats_fold ();
+  pthread_mutex_lock (&stats_lock);
+  *stats = stats_total;
+  pthread_mutex_unlock (&stats_lock);
+  return 0;
+#else
+  memset (stats, 0, sizeof (lz77_stats_t));
+  return -1;
+#endif
+}
+
+void lz77_stats_reset () {
+#ifdef LZ77_STATS
+  pthread_mutex_lock (&stats_lock);
+  memset (&stats_total, 0, sizeof (stats_total));
+  pthread_mutex_unlock (&stats_lock);
+#endif
+}
+
+static void print_hist (FILE *file, const char *name, const uint64_t *hist,
+    int buckets, int offset) {
+  int i;
+  uint64_t total;
+
+  for (i = 0, total = 0; i < buckets; i++) {
+    total += hist[i];
+  }
+  fprintf (file, "%s:\n", name);
+  for (i = 0; i < buckets; i++) {
+    if (!hist[i]) continue;
+    if (offset < 0) {
+      fprintf (file, "  %10d %12lu %5.1f%%\n", i, hist[i],
+          hist[i] * 100.0 / total);
+    } else {
+      // Bucket i holds values 2^(i-offset) to 2^(i-offset+1) - 1
+      fprintf (file, "  %4lu-%-5lu %12lu %5.1f%%\n",
+          i < offset ? 0 : 1UL << (i - offset),
+          i < offset ? 0 : (1UL << (i - offset + 1)) - 1, hist[i],
+          hist[i] * 100.0 / total);
+    }
+  }
+}
+
+void lz77_stats_print (FILE *file, const lz77_stats_t *stats) {
+  uint64_t commands = stats->literals + stats->pointers;
+
+  fprintf (file, "bytes in:        %lu\n", stats->bytes_in);
+  fprintf (file, "bytes out:       %lu\n", stats->bytes_out);
+  fprintf (file, "literals:        %lu (%.1f%% of commands)\n",
+      stats->literals, commands ? stats->literals * 100.0 / commands : 0);
+  fprintf (file, "pointers:        %lu\n", stats->pointers);
+  fprintf (file, "finds:           %lu\n", stats->finds);
+  fprintf (file, "probes:          %lu (%.2f per find)\n", stats->probes,
+      stats->finds ? (double) stats->probes / stats->finds : 0);
+  fprintf (file, "inserts:         %lu\n", stats->inserts);
+  fprintf (file, "read time:       %.3f s\n", stats->read_time);
+  fprintf (file, "write time:      %.3f s\n", stats->write_time);
+  fprintf (file, "compress time:   %.3f s\n", stats->compress_time);
+  fprintf (file, "decompress time: %.3f s\n", stats->decompress_time);
+  print_hist (file, "chain links followed per find", stats->chain_hist,
+      STATS_CHAIN_BUCKETS, 1);
+  print_hist (file, "pointer lengths", stats->length_hist,
+      STATS_LENGTH_BUCKETS, -1);
+  print_hist (file, "pointer distances", stats->distance_hist,
+      STATS_DISTANCE_BUCKETS, 0);
+}
@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Buckets of the histograms, by the highest bit set in the value counted
+// but for lengths, counted as they are, large enough for every format
+// preset of compression.h
+#define STATS_CHAIN_BUCKETS 14
+#define STATS_LENGTH_BUCKETS 259
+#define STATS_DISTANCE_BUCKETS 21
+
+/* Counters of the compressor and decompressor, only gathered when built
+ * with -DLZ77_STATS. Every thread counts in its own copy, added to the
+ * process wide totals when a file or buffer compression or decompression
+ * returns, or when the thread gets the totals. Times are in seconds.
+ */
+typedef struct lz77_stats {
+  // Match finder: lookups, positions compared, positions linked and the
+  // links followed per lookup, bucket i holding 2^(i-1) to 2^i - 1 links
+  uint64_t finds;
+  uint64_t probes;
+  uint64_t inserts;
+  uint64_t chain_hist[STATS_CHAIN_BUCKETS];
+
+  // Commands written, by length for <1,POINTER,LENGTH> and by distance
+  // with bucket i holding distances 2^i to 2^(i+1) - 1, counted as
+  // STATS_HIST (distance_hist, distance >> 1)
+  uint64_t literals;
+  uint64_t pointers;
+  uint64_t length_hist[STATS_LENGTH_BUCKETS];
+  uint64_t distance_hist[STATS_DISTANCE_BUCKETS];
+
+  // Bytes taken in and given out by compressions and decompressions
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+
+  // Time spent reading and writing files, and in whole compressions and
+  // decompressions including their reads and writes
+  double read_time;
+  double write_time;
+  double compress_time;
+  double decompress_time;
+} lz77_stats_t;
+
+int lz77_stats_get (lz77_stats_t *stats);
+void lz77_stats_reset ();
+void lz77_stats_print (FILE *file, const lz77_stats_t *stats);
+
+// Declare a timer t, unused when built without counters
+#define STATS_TIMER(t) double t __attribute__ ((unused))
+
+#ifdef LZ77_STATS
+extern __thread lz77_stats_t stats_local;
+extern __thread int stats_paused;
+double stats_now ();
+void stats_fold ();
+
+#define STATS_ADD(field, n) (stats_local.field += (n))
+// Count value in the bucket of its highest bit set, 0 in bucket 0
+#define STATS_HIST(field, value) \
+  (stats_local.field[(value) ? 32 - __builtin_clz (value) : 0]++)
+#define STATS_START(t) (t = stats_now ())
+#define STATS_STOP(field, t) (stats_local.field += stats_now () - (t))
+#define STATS_FOLD() stats_fold ()
+// Leave the work done between STATS_PAUSE and STATS_RESUME out of the
+// counters, such as trial compressions: the counters of the thread are
+// saved in s, declared with STATS_SAVED, and not folded until restored
+#define STATS_SAVED(s) lz77_stats_t s
+#define STATS_PAUSE(s) (s = stats_local, stats_paused = 1)
+#define STATS_RESUME(s) (stats_local = s, stats_paused = 0)
+#else
+#define STATS_ADD(field, n) ((void) 0)
+#define STATS_HIST(field, value) ((void) 0)
+#define STATS_START(t) ((void) 0)
+#define STATS_STOP(field, t) ((void) 0)
+#define STATS_FOLD() ((void) 0)
+#define STATS_SAVED(s) int s __attribute__ ((unused))
+#define STATS_PAUSE(s) ((void) 0)
+#define STATS_RESUME(s) ((void) 0)
+#endif
+
+#endif
@@ -6,8 +6,7 @@
 #include <unistd.h>
 #include "bit_stream.h"
 #include "compression.h"
-#include "queue.h"
-#include "hash.h"
+#include "frame.h"
 
 #ifndef __WHERE__
 #define __WHERE__
@@ -16,7 +15,7 @@
 
 void test_compress_file (FILE *in, FILE *out) {
   bit_out_stream_t *out_stream;
-  out_stream = bit_out_stream_new (out);
+  out_stream = bit_out_stream_new (out, 0);
 
   write_1bit (out_stream, 0);
   write_8bits (out_stream, 'm');
@@ -38,7 +37,7 @@ void test_compress_file (FILE *in, FILE *out) {
 
 void test_compress_file_2 (FILE *in, FILE *out) {
   bit_out_stream_t *out_stream;
-  out_stream = bit_out_stream_new (out);
+  out_stream = bit_out_stream_new (out, 0);
 
   write_1bit (out_stream, 0);
   write_8bits (out_stream, 'a');
@@ -124,192 +123,199 @@ void print_12bits(FILE *in) {
   }
 }
 
-void print_key_bytes (uint8_t *key, int len) {
-  int i;
-  for (i = 0; i < len; i++) {
-    printf ("0x%x ", key[i]);
+void test_buffer_roundtrip () {
+  int level;
+  uint8_t *src = (uint8_t*) "mahi mahi";
+  uint8_t compressed[0x10], decompressed[0x10];
+  size_t compressed_len, decompressed_len;
+
+  for (level = COMPRESS_MIN_LEVEL; level <= COMPRESS_MAX_LEVEL; level++) {
+    assert (compress_buffer (src, 9, compressed, compress_bound (9),
+          &compressed_len, level) == 0);
+    printf ("level %d compressed %lu bytes\n", level, compressed_len);
+    assert (decompress_buffer (compressed, compressed_len, decompressed,
+          sizeof (decompressed), &decompressed_len) == 0);
+    assert (decompressed_len == 9 && memcmp (src, decompressed, 9) == 0);
   }
 }
 
-void print_key_chars (uint8_t *key, int len) {
+/* Compress the len bytes at src to a frame of block_size blocks and check
+ * it decompresses back to them. Return the frame, to be freed.
+ */
+uint8_t* framed_roundtrip (const uint8_t *src, size_t len,
+    uint32_t block_size, size_t *framed_len) {
+  uint8_t *framed, *decompressed;
+  uint64_t size;
+  FILE *in, *out;
+
+  in = fmemopen ((void*) src, len, "rb");
+  out = open_memstream ((char**) &framed, framed_len);
+  assert (in && out);
+  assert (compress_framed (in, out, 2, block_size, COMPRESS_DEFAULT_LEVEL)
+      == 0);
+  printf ("framed %lu bytes to %lu\n", len, *framed_len);
+
+  assert (framed_size (framed, *framed_len, &size) == (len + block_size - 1)
+      / block_size && size == len);
+  decompressed = malloc (len);
+  assert (decompress_framed_buffer (framed, *framed_len, decompressed, 2)
+      == 0);
+  assert (memcmp (src, decompressed, len) == 0);
+  free (decompressed);
+  return framed;
+}
+
+void test_framed_roundtrip () {
   int i;
+  uint8_t *src, *framed;
+  size_t span, len, block_size, framed_len;
+
+  // The smallest block sampled, the samples spread over it
+  span = FRAME_SAMPLE_SIZE > 2 * PTR_SIZE ? FRAME_SAMPLE_SIZE : 2 * PTR_SIZE;
+  block_size = FRAME_SAMPLES * span * 2;
+  len = block_size * 2 + 1000;
+  src = malloc (len);
+  assert (src);
+
+  // Text compresses, no block is stored
   for (i = 0; i < len; i++) {
-    if (key[i] != '\n') printf ("%c", key[i]);
-    else printf ("\\n");
+    src[i] = "mahi mahi "[i % 10] + (i / 1000) % 8;
+  }
+  framed = framed_roundtrip (src, len, block_size, &framed_len);
+  assert (!(framed[FRAME_HEADER_SIZE + 3] & FRAME_STORED >> 24));
+  assert (framed_len < len / 2);
+  free (framed);
+
+  // Random bytes in the samples only are enough to store the first block,
+  // the zeros in between are not searched, and random bytes everywhere
+  // have every block stored
+  srand (1);
+  memset (src, 0, len);
+  for (i = 0; i < FRAME_SAMPLES; i++) {
+    memset (src + (block_size - span) * i / (FRAME_SAMPLES - 1), 1, span);
   }
+  for (i = 0; i < len; i++) {
+    if (i >= block_size || src[i]) src[i] = rand ();
+  }
+  framed = framed_roundtrip (src, len, block_size, &framed_len);
+  assert (framed[FRAME_HEADER_SIZE + 3] & FRAME_STORED >> 24);
+  assert (framed_len == FRAME_HEADER_SIZE + 4 * FRAME_BLOCK_HEADER_SIZE
+      + len);
+  free (framed);
+  free (src);
 }
 
-void print_hash_table (hash_t *hash) {
+void test_spliced_roundtrip () {
   int i;
-  list_t* list;
-
-  for (i = 0; i < hash->size; i++) {
-    if (!hash->array[i]) continue;
-    printf ("Entry[%4d] => ", i);
-    list = hash->array[i];
-    while (list) {
-      printf ("[");
-      print_key_chars (list->key, list->key_len);
-      printf ("]:%ld => ", list->value);
-      list = list->next;
-    }
-    printf ("\n");
+  uint8_t *dict = (uint8_t*) "mahi mahi";
+  uint8_t src[10000], decompressed[10000], *compressed;
+  size_t compressed_len, decompressed_len;
+  FILE *in, *out;
+
+  for (i = 0; i < sizeof (src); i++) {
+    src[i] = "mahi mahi "[i % 10] + (i / 100) % 8;
   }
-  printf ("\n");
+  // Blocks of an odd number of bytes end in the middle of a byte
+  in = fmemopen (src, sizeof (src), "rb");
+  out = open_memstream ((char**) &compressed, &compressed_len);
+  assert (in && out);
+  assert (compress_spliced (in, out, 3, 1001, COMPRESS_DEFAULT_LEVEL,
+        dict, 9) == 0);
+  printf ("spliced %lu bytes\n", compressed_len);
+  assert (decompress_buffer_dict (compressed, compressed_len, decompressed,
+        sizeof (decompressed), &decompressed_len, dict, 9) == 0);
+  assert (decompressed_len == sizeof (src)
+      && memcmp (src, decompressed, sizeof (src)) == 0);
+  free (compressed);
 }
 
-void test_hash_insert () {
-  hash_t *hash = hash_new (0x1000);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-  hash_destroy (&hash);
-}
+void test_stream_roundtrip () {
+  int i;
+  uint8_t *src = (uint8_t*) "mahi mahi";
+  uint8_t compressed[0x10], decompressed[0x10];
+  size_t compressed_len, decompressed_len, src_used, dst_used;
+  lz77_cstream_t *cstream = lz77_cstream_new (COMPRESS_DEFAULT_LEVEL);
+  lz77_dstream_t *dstream = lz77_dstream_new ();
 
-void test_hash_insert_2 () {
-  hash_t *hash = hash_new (0x1);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-  hash_destroy (&hash);
-}
+  // One byte in and out at a time
+  compressed_len = 0;
+  for (i = 0; i < 9; i += src_used) {
+    assert (lz77_cstream_update (cstream, src + i, 1, &src_used,
+          compressed + compressed_len, 1, &dst_used) == 0);
+    compressed_len += dst_used;
+  }
+  while (lz77_cstream_finish (cstream, compressed + compressed_len, 1,
+        &dst_used) == 1) {
+    compressed_len += dst_used;
+  }
+  compressed_len += dst_used;
+  printf ("streamed %lu bytes\n", compressed_len);
 
-int test_value_leq (uint64_t value, uint64_t arg) {
-  return (value <= arg);
-}
+  decompressed_len = 0;
+  for (i = 0; i < compressed_len; i += src_used) {
+    assert (lz77_dstream_update (dstream, compressed + i, 1, &src_used,
+          decompressed + decompressed_len, 1, &dst_used) == 0);
+    decompressed_len += dst_used;
+  }
+  while (lz77_dstream_finish (dstream, decompressed + decompressed_len, 1,
+        &dst_used) == 1) {
+    decompressed_len += dst_used;
+  }
+  decompressed_len += dst_used;
+  assert (decompressed_len == 9 && memcmp (src, decompressed, 9) == 0);
 
-void test_hash_delete () {
-  hash_t *hash = hash_new (0x1000);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-
-  hash_delete (hash, (uint8_t*) "abcd", 4, NULL, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "bcde", 4, test_value_leq, 8);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "zZZZ", 4, NULL, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "abc", 3, NULL, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "a", 1, test_value_leq, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "a", 1, test_value_leq, 10);
-  print_hash_table (hash);
-  hash_destroy (&hash);
+  lz77_cstream_destroy (&cstream);
+  lz77_dstream_destroy (&dstream);
 }
 
-void test_hash_delete_2 () {
-  hash_t *hash = hash_new (0x1);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-
-  hash_delete (hash, (uint8_t*) "abcd", 4, NULL, 5);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "bcde", 4, test_value_leq, 8);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "zZZZ", 4, test_value_leq, 100);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "abc", 3, NULL, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "a", 1, test_value_leq, 0);
-  print_hash_table (hash);
-  hash_delete (hash, (uint8_t*) "a", 1, test_value_leq, 10);
-  print_hash_table (hash);
-  hash_destroy (&hash);
-}
+void test_dict_roundtrip () {
+  uint8_t *dict = (uint8_t*) "mahi mahi";
+  uint8_t *src = (uint8_t*) "mahi";
+  uint8_t compressed[0x10], decompressed[0x10];
+  size_t compressed_len, decompressed_len;
 
-void test_hash_lookup () {
-  uint64_t value;
-  hash_t *hash = hash_new (0x100);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-
-  hash_lookup (hash, (uint8_t*) "a", 1, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "ab", 2, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "abc", 3, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "abcd", 4, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "b", 1, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bc", 2, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bcd", 3, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bcde", 4, &value);
-  printf ("value %ld\n", value);
-  hash_destroy (&hash);
+  // The whole input is a pointer into the dictionary
+  assert (compress_buffer_dict (src, 4, compressed, compress_bound (4),
+        &compressed_len, COMPRESS_DEFAULT_LEVEL, dict, 9) == 0);
+  printf ("with a dictionary compressed %lu bytes\n", compressed_len);
+  assert (compressed_len == 3);
+  assert (decompress_buffer_dict (compressed, compressed_len, decompressed,
+        sizeof (decompressed), &decompressed_len, dict, 9) == 0);
+  assert (decompressed_len == 4 && memcmp (src, decompressed, 4) == 0);
+  // Cut short the pointer is not taken for padding
+  assert (decompress_buffer_dict (compressed, compressed_len - 1, decompressed,
+        sizeof (decompressed), &decompressed_len, dict, 9) != 0);
+  // Without it the pointer reaches before the start of the output
+  assert (decompress_buffer (compressed, compressed_len, decompressed,
+        sizeof (decompressed), &decompressed_len) != 0);
 }
 
-void test_hash_lookup_2 () {
-  uint64_t value;
-  hash_t *hash = hash_new (0x1);
-  hash_insert (hash, (uint8_t*) "a", 1, 1);
-  hash_insert (hash, (uint8_t*) "ab", 2, 2);
-  hash_insert (hash, (uint8_t*) "abc", 3, 3);
-  hash_insert (hash, (uint8_t*) "abcd", 4, 4);
-  hash_insert (hash, (uint8_t*) "b", 1, 5);
-  hash_insert (hash, (uint8_t*) "bc", 2, 6);
-  hash_insert (hash, (uint8_t*) "bcd", 3, 7);
-  hash_insert (hash, (uint8_t*) "bcde", 4, 8);
-  print_hash_table (hash);
-
-  hash_lookup (hash, (uint8_t*) "a", 1, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "ab", 2, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "abc", 3, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "abcd", 4, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "b", 1, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bc", 2, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bcd", 3, &value);
-  printf ("value %ld\n", value);
-  hash_lookup (hash, (uint8_t*) "bcde", 4, &value);
-  printf ("value %ld\n", value);
-  hash_destroy (&hash);
+void test_cctx_reuse () {
+  int i;
+  uint8_t *src[2] = {(uint8_t*) "mahi mahi", (uint8_t*) "hi hi hi"};
+  uint8_t compressed[0x10], expected[0x10];
+  size_t compressed_len, expected_len;
+  lz77_cctx_t *ctx = lz77_cctx_new ();
+
+  // Nothing of an input is pointed to by the next one
+  for (i = 0; i < 4; i++) {
+    assert (lz77_cctx_compress (ctx, src[i % 2], 8, compressed,
+          sizeof (compressed), &compressed_len, COMPRESS_DEFAULT_LEVEL,
+          NULL, 0) == 0);
+    assert (compress_buffer (src[i % 2], 8, expected, sizeof (expected),
+          &expected_len, COMPRESS_DEFAULT_LEVEL) == 0);
+    assert (compressed_len == expected_len
+        && memcmp (compressed, expected, expected_len) == 0);
+  }
+  lz77_cctx_destroy (&ctx);
 }
 
 int main (int argc, char* argv[]) {
-  test_hash_lookup ();
-  test_hash_lookup_2 ();
+  test_buffer_roundtrip ();
+  test_framed_roundtrip ();
+  test_spliced_roundtrip ();
+  test_stream_roundtrip ();
+  test_dict_roundtrip ();
+  test_cctx_reuse ();
   return 0;
 }
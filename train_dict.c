@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "compression.h"
+#include "dict.h"
+
+/* Train a preset dictionary from sample files, one message per file,
+ * and report how much it shrinks the samples compressed one by one.
+ */
+
+/* Append the content of filename to *samples, which holds *len bytes out
+ * of *size, growing it as needed. The bytes read are put in read.
+ * Return 0 for success and -1 for failure.
+ */
+int read_sample (const char *filename, uint8_t **samples, size_t *len,
+    size_t *size, size_t *read) {
+  FILE *file;
+  size_t n;
+  uint8_t *grown;
+
+  file = fopen (filename, "rb");
+  if (!file) {
+    fprintf (stderr, "Failed to open file %s\n", filename);
+    perror ("fopen");
+    return -1;
+  }
+  *read = 0;
+  do {
+    if (*len == *size) {
+      *size = *size ? *size * 2 : 0x10000;
+      grown = realloc (*samples, *size);
+      if (!grown) {
+        perror ("realloc");
+        fclose (file);
+        return -1;
+      }
+      *samples = grown;
+    }
+    n = fread (*samples + *len, 1, *size - *len, file);
+    *len += n;
+    *read += n;
+  } while (n);
+  fclose (file);
+  return 0;
+}
+
+/* Compress every sample at level on its own, with the dict_len bytes of
+ * dict if not 0, and return the total compressed size
+ */
+size_t compressed_size (const uint8_t *samples, const size_t *sample_lens,
+    int count, int level, const uint8_t *dict, size_t dict_len) {
+  int i;
+  uint8_t *dst;
+  size_t total, len, max;
+
+  for (max = 0, i = 0; i < count; i++) {
+    if (sample_lens[i] > max) max = sample_lens[i];
+  }
+  dst = malloc (compress_bound (max));
+  if (!dst) {
+    return 0;
+  }
+  for (total = 0, i = 0; i < count; samples += sample_lens[i], i++) {
+    if (compress_buffer_dict (samples, sample_lens[i], dst,
+          compress_bound (max), &len, level, dict, dict_len) == 0) {
+      total += len;
+    }
+  }
+  free (dst);
+  return total;
+}
+
+void usage (char *name) {
+  printf ("Usage:\n%s -o DICT SAMPLE... to train DICT from SAMPLE files\n"
+      "Options:\n"
+      "  -s SIZE  size of the dictionary in bytes, at most and default %d\n"
+      "  -1 .. -9 level the samples are compressed at to report the gain,\n"
+      "           default -%d\n",
+      name, PTR_SIZE, COMPRESS_DEFAULT_LEVEL);
+}
+
+int main (int argc, char* argv[]) {
+  int c, i, count, level;
+  long size;
+  uint8_t *dict, *samples;
+  size_t len, samples_size, dict_len, plain, primed;
+  size_t *sample_lens;
+  char *output_filename;
+  FILE *out;
+
+  output_filename = NULL;
+  size = PTR_SIZE;
+  level = COMPRESS_DEFAULT_LEVEL;
+  opterr = 0;
+  while ((c = getopt (argc, argv, "o:s:123456789")) != -1) {
+    switch (c) {
+      case 'o':
+        output_filename = optarg;
+        break;
+      case 's':
+        size = atol (optarg);
+        if (size < 1 || size > PTR_SIZE) {
+          usage (argv[0]);
+          return 1;
+        }
+        break;
+      case '1': case '2': case '3': case '4': case '5':
+      case '6': case '7': case '8': case '9':
+        level = c - '0';
+        break;
+      default:
+        usage (argv[0]);
+        return 1;
+    }
+  }
+  if (!output_filename || optind >= argc) {
+    usage (argv[0]);
+    return 1;
+  }
+
+  count = argc - optind;
+  sample_lens = malloc (count * sizeof (size_t));
+  dict = malloc (size);
+  if (!sample_lens || !dict) {
+    perror ("malloc");
+    free (sample_lens);
+    free (dict);
+    return 1;
+  }
+  samples = NULL;
+  len = 0;
+  samples_size = 0;
+  for (i = 0; i < count; i++) {
+    if (read_sample (argv[optind + i], &samples, &len, &samples_size,
+          sample_lens + i) != 0) {
+      free (samples);
+      free (sample_lens);
+      free (dict);
+      return 1;
+    }
+  }
+
+  dict_len = dict_train (samples, sample_lens, count, dict, size);
+  if (!dict_len && len) {
+    fprintf (stderr, "Failed to train a dictionary\n");
+    free (samples);
+    free (sample_lens);
+    free (dict);
+    return 1;
+  }
+  out = fopen (output_filename, "wb");
+  if (!out || fwrite (dict, 1, dict_len, out) != dict_len) {
+    fprintf (stderr, "Failed to write file %s\n", output_filename);
+    perror ("fwrite");
+    if (out) fclose (out);
+    free (samples);
+    free (sample_lens);
+    free (dict);
+    return 1;
+  }
+  fclose (out);
+
+  plain = compressed_size (samples, sample_lens, count, level, NULL, 0);
+  primed = compressed_size (samples, sample_lens, count, level, dict,
+      dict_len);
+  fprintf (stderr, "%d samples, %lu bytes\n", count, (unsigned long) len);
+  fprintf (stderr, "Dictionary of %lu bytes, ID %08x\n",
+      (unsigned long) dict_len, dict_id (dict, dict_len));
+  fprintf (stderr, "Compressed at -%d: %lu bytes without it, %lu with it\n",
+      level, (unsigned long) plain, (unsigned long) primed);
+
+  free (samples);
+  free (sample_lens);
+  free (dict);
+  return 0;
+}